@@ -0,0 +1,7 @@
+#include "set.hpp"
+#include "counted.h"
+#include "test_allocator.h"
+using container = set<counted, std::less<counted>, test_allocator<counted, TEST_ALLOCATOR_PROPAGATE>>;
+
+#include "set_testing.inl"
+#include "allocator_testing.inl"
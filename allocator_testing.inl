@@ -0,0 +1,139 @@
+// Tests of allocator handling, container is instantiated with test_allocator.
+
+using allocator = container::allocator_type;
+
+constexpr bool propagate = std::allocator_traits<allocator>::propagate_on_container_copy_assignment::value;
+
+TEST(allocator, get_allocator)
+{
+counted::no_new_instances_guard g;
+
+container c(allocator(5));
+mass_insert(c, {3, 1, 2});
+EXPECT_EQ(allocator(5), c.get_allocator());
+}
+
+TEST(allocator, copy_ctor)
+{
+counted::no_new_instances_guard g;
+
+container c(allocator(5));
+mass_insert(c, {3, 1, 2});
+container c2 = c;
+EXPECT_EQ(propagate, c2.get_allocator() != c.get_allocator());
+c.insert(4);
+expect_eq(c2, {1, 2, 3});
+expect_eq(c, {1, 2, 3, 4});
+}
+
+TEST(allocator, copy_ctor_with_allocator)
+{
+counted::no_new_instances_guard g;
+
+container c(allocator(5));
+mass_insert(c, {3, 1, 2});
+container c2(c, allocator(6));
+EXPECT_EQ(allocator(6), c2.get_allocator());
+c2.erase(c2.begin());
+expect_eq(c, {1, 2, 3});
+expect_eq(c2, {2, 3});
+}
+
+TEST(allocator, assignment_operator)
+{
+counted::no_new_instances_guard g;
+
+container c(allocator(5));
+mass_insert(c, {3, 1, 2});
+container c2(allocator(6));
+mass_insert(c2, {7, 8});
+c2 = c;
+EXPECT_EQ(propagate ? allocator(5) : allocator(6), c2.get_allocator());
+c2.insert(4);
+c.insert(0);
+expect_eq(c, {0, 1, 2, 3});
+expect_eq(c2, {1, 2, 3, 4});
+}
+
+TEST(allocator, swap)
+{
+counted::no_new_instances_guard g;
+
+container c(allocator(5));
+mass_insert(c, {3, 1, 2});
+container c2(propagate ? allocator(6) : allocator(5));
+mass_insert(c2, {7, 8});
+swap(c, c2);
+EXPECT_EQ(propagate ? allocator(6) : allocator(5), c.get_allocator());
+EXPECT_EQ(allocator(5), c2.get_allocator());
+c.insert(9);
+c2.insert(4);
+expect_eq(c, {7, 8, 9});
+expect_eq(c2, {1, 2, 3, 4});
+}
+
+TEST(allocator, move_ctor)
+{
+counted::no_new_instances_guard g;
+
+container c(allocator(5));
+mass_insert(c, {3, 1, 2});
+container c2 = std::move(c);
+EXPECT_EQ(allocator(5), c2.get_allocator());
+expect_eq(c2, {1, 2, 3});
+container c3(std::move(c2), allocator(6));
+EXPECT_EQ(allocator(6), c3.get_allocator());
+expect_eq(c3, {1, 2, 3});
+c3.insert(4);
+expect_eq(c3, {1, 2, 3, 4});
+}
+
+TEST(allocator, move_assignment)
+{
+counted::no_new_instances_guard g;
+
+container c(allocator(5));
+mass_insert(c, {3, 1, 2});
+container c2(allocator(6));
+mass_insert(c2, {7, 8});
+c2 = std::move(c);
+EXPECT_EQ(propagate ? allocator(5) : allocator(6), c2.get_allocator());
+expect_eq(c2, {1, 2, 3});
+c2.insert(4);
+expect_eq(c2, {1, 2, 3, 4});
+}
+
+TEST(allocator, assignment_reuses_nodes)
+{
+using int_allocator = test_allocator<int, propagate>;
+using int_set = set<int, std::less<int>, int_allocator>;
+
+int_set c(int_allocator(5));
+for (int i = 1; i != 6; ++i)
+    c.insert(i);
+int_set c2(int_allocator(6));
+for (int i = 10; i != 18; ++i)
+    c2.insert(i);
+std::vector<int const*> nodes;
+for (int const& e : c2)
+    nodes.push_back(&e);
+
+c2 = c;
+EXPECT_TRUE(std::equal(c.begin(), c.end(), c2.begin(), c2.end()));
+for (int const& e : c2)
+    EXPECT_EQ(!propagate, std::find(nodes.begin(), nodes.end(), &e) != nodes.end());
+
+for (int i = 6; i != 11; ++i)
+    c.insert(i);
+c2 = c;
+EXPECT_TRUE(std::equal(c.begin(), c.end(), c2.begin(), c2.end()));
+EXPECT_EQ(propagate ? c.get_allocator() : int_allocator(6), c2.get_allocator());
+c2.insert(0);
+c.erase(c.find(5));
+EXPECT_EQ(9u, c.size());
+EXPECT_EQ(11u, c2.size());
+EXPECT_EQ(0, *c2.begin());
+EXPECT_EQ(10, *c2.rbegin());
+EXPECT_EQ(6, *c.upper_bound(4));
+EXPECT_EQ(5, *c2.upper_bound(4));
+}
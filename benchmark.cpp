@@ -0,0 +1,589 @@
+#include "set.hpp"
+#include "threaded_set.hpp"
+#include "hugepage_allocator.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Rough timings of the set variants. Not a test: run it on a quiet machine
+// from an optimized build.
+
+// std::string whose nodes cache a key prefix.
+struct prefixed_string
+{
+    std::string s;
+
+    friend bool operator<(prefixed_string const& a, prefixed_string const& b)
+    {
+        return a.s < b.s;
+    }
+};
+
+template <>
+struct set_key_prefix<prefixed_string>
+{
+    std::uint64_t operator()(prefixed_string const& k) const noexcept
+    {
+        return set_bytes_prefix(k.s.data(), k.s.size());
+    }
+};
+
+namespace
+{
+    template <typename F>
+    double measure(int repeats, F const& f)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i != repeats; ++i)
+            f();
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        return elapsed.count() / repeats;
+    }
+
+    std::vector<int> random_keys(size_t n)
+    {
+        std::mt19937 rng(42);
+        std::vector<int> keys(n);
+        for (int& k : keys)
+            k = static_cast<int>(rng());
+        return keys;
+    }
+
+    volatile long long sink;
+
+    // Counts data TLB misses of the calling thread with perf_event_open.
+    // Where perf events are not available (containers, some VMs) the counter
+    // stays closed and reports -1.
+    struct dtlb_counter
+    {
+        dtlb_counter()
+        {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_DTLB
+                          | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                          | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        }
+
+        ~dtlb_counter()
+        {
+            if (fd != -1)
+                close(fd);
+        }
+
+        template <typename F>
+        long long count(F const& f)
+        {
+            if (fd == -1)
+            {
+                f();
+                return -1;
+            }
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+            f();
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            long long result;
+            if (read(fd, &result, sizeof(result)) != sizeof(result))
+                return -1;
+            return result;
+        }
+
+    private:
+        int fd;
+    };
+
+    template <typename C>
+    void bench_find(char const* name, std::vector<int> const& keys, std::vector<int> const& queries)
+    {
+        C c;
+        for (int k : keys)
+            c.insert(k);
+
+        dtlb_counter counter;
+        double elapsed = 0;
+        long long misses = counter.count([&]
+        {
+            elapsed = measure(1, [&]
+            {
+                long long found = 0;
+                for (int q : queries)
+                    found += c.find(q) != c.end();
+                sink = found;
+            });
+        });
+        if (misses < 0)
+            std::printf("%-16s %9zu elements: %8.3f ms, dTLB misses n/a\n", name, c.size(), elapsed);
+        else
+            std::printf("%-16s %9zu elements: %8.3f ms, dTLB misses %lld\n", name, c.size(), elapsed, misses);
+    }
+
+    // Looks queries up 256 at a time, one find after another and batched.
+    template <typename K>
+    void bench_find_many(char const* name, std::vector<K> const& keys, std::vector<K> const& queries)
+    {
+        set<K> c;
+        for (K const& k : keys)
+            c.insert(k);
+
+        size_t const batch = 256;
+        double serial = measure(3, [&]
+        {
+            long long found = 0;
+            for (K const& q : queries)
+                found += c.find(q) != c.end();
+            sink = found;
+        });
+        std::vector<typename set<K>::const_iterator> found(batch);
+        double many = measure(3, [&]
+        {
+            for (size_t i = 0; i < queries.size(); i += batch)
+                c.find_many(queries.begin() + i, queries.begin() + std::min(i + batch, queries.size()), found.begin());
+            sink = found[0] != c.end();
+        });
+        std::uint64_t bitmap[batch / 64];
+        double contains = measure(3, [&]
+        {
+            long long hits = 0;
+            for (size_t i = 0; i < queries.size(); i += batch)
+            {
+                c.contains_many(queries.begin() + i, queries.begin() + std::min(i + batch, queries.size()), bitmap);
+                for (std::uint64_t w : bitmap)
+                    hits += __builtin_popcountll(w);
+            }
+            sink = hits;
+        });
+        std::printf("%-8s %9zu elements: find %8.3f ms, find_many %8.3f ms, contains_many %8.3f ms\n",
+                    name, c.size(), serial, many, contains);
+    }
+
+    // Adds batches of unsorted keys, a quarter of them present already, to
+    // a set of n elements one by one and with insert_many.
+    void bench_insert_many(std::vector<int> const& keys, size_t batch)
+    {
+        size_t n = keys.size() / 2;
+        set<int> base(keys.begin(), keys.begin() + n);
+        auto run = [&](auto add)
+        {
+            std::vector<set<int>> copies(3, base);
+            size_t next = 0;
+            return measure(3, [&]
+            {
+                set<int>& c = copies[next++];
+                for (size_t i = 0; i + batch <= n; i += batch)
+                    add(c, keys.begin() + n + i - batch / 4, keys.begin() + n + i + batch * 3 / 4);
+                sink = c.size();
+            });
+        };
+        double single = run([](set<int>& c, auto first, auto last)
+        {
+            for (; first != last; ++first)
+                c.insert(*first);
+        });
+        double many = run([](set<int>& c, auto first, auto last) { c.insert_many(first, last); });
+        std::printf("%9zu elements, batches of %4zu: insert %8.3f ms, insert_many %8.3f ms\n",
+                    n, batch, single, many);
+    }
+
+    template <typename C>
+    void bench_scan(char const* name, std::vector<int> const& keys)
+    {
+        C c;
+        for (int k : keys)
+            c.insert(k);
+
+        double forward = measure(20, [&]
+        {
+            long long sum = 0;
+            for (int x : c)
+                sum += x;
+            sink = sum;
+        });
+        double backward = measure(20, [&]
+        {
+            long long sum = 0;
+            for (auto i = c.rbegin(); i != c.rend(); ++i)
+                sum += *i;
+            sink = sum;
+        });
+        std::printf("%-16s %9zu elements: forward %8.3f ms, backward %8.3f ms\n",
+                    name, c.size(), forward, backward);
+    }
+
+    std::vector<std::string> random_strings(size_t n)
+    {
+        std::mt19937 rng(42);
+        std::vector<std::string> keys(n);
+        for (std::string& k : keys)
+        {
+            k.resize(24);
+            for (char& c : k)
+                c = static_cast<char>('a' + rng() % 26);
+        }
+        return keys;
+    }
+
+    template <typename K>
+    void bench_strings(char const* name, std::vector<std::string> const& keys)
+    {
+        set<K> c;
+        for (std::string const& k : keys)
+            c.insert(K{k});
+
+        std::vector<K> queries;
+        for (size_t i = keys.size(); i-- > 0;)
+            queries.push_back(K{keys[i]});
+        double elapsed = measure(1, [&]
+        {
+            long long found = 0;
+            for (K const& q : queries)
+                found += c.find(q) != c.end();
+            sink = found;
+        });
+        std::printf("%-16s %9zu elements: %8.3f ms\n", name, c.size(), elapsed);
+    }
+
+    // Sorted keys with every block of 16 shuffled.
+    std::vector<int> locally_shuffled(size_t n)
+    {
+        std::vector<int> keys(n);
+        for (size_t i = 0; i != n; ++i)
+            keys[i] = static_cast<int>(i);
+        std::mt19937 rng(42);
+        for (size_t i = 0; i < n; i += 16)
+            std::shuffle(keys.begin() + i, keys.begin() + std::min(n, i + 16), rng);
+        return keys;
+    }
+
+    void bench_hint(char const* stream, std::vector<int> const& keys)
+    {
+        double plain = measure(1, [&]
+        {
+            set<int> c;
+            for (int k : keys)
+                c.insert(k);
+            sink = static_cast<long long>(c.size());
+        });
+        double end = measure(1, [&]
+        {
+            set<int> c;
+            for (int k : keys)
+                c.insert(c.end(), k);
+            sink = static_cast<long long>(c.size());
+        });
+        double last = measure(1, [&]
+        {
+            set<int> c;
+            set<int>::iterator i = c.end();
+            for (int k : keys)
+                i = c.insert(i, k);
+            sink = static_cast<long long>(c.size());
+        });
+        std::printf("%-16s %9zu elements: insert %8.3f ms, hint end() %8.3f ms, hint last %8.3f ms\n",
+                    stream, keys.size(), plain, end, last);
+    }
+
+    // Scans and lookups in a set whose nodes were scattered by churn, before
+    // and after compact().
+    void bench_compact(std::vector<int> const& keys)
+    {
+        set<int> c;
+        for (int k : keys)
+            c.insert(k);
+        std::mt19937 rng(7);
+        for (size_t i = 0; i != keys.size(); ++i)
+        {
+            auto it = c.lower_bound(static_cast<int>(rng()));
+            c.erase(it == c.end() ? c.begin() : it);
+            c.insert(static_cast<int>(rng()));
+        }
+
+        auto run = [&](char const* name)
+        {
+            double scan = measure(20, [&]
+            {
+                long long sum = 0;
+                for (int x : c)
+                    sum += x;
+                sink = sum;
+            });
+            double find = measure(1, [&]
+            {
+                long long found = 0;
+                for (int k : keys)
+                    found += c.find(k) != c.end();
+                sink = found;
+            });
+            std::printf("%-16s %9zu elements: scan %8.3f ms, find %8.3f ms\n", name, c.size(), scan, find);
+        };
+        run("churned");
+        c.compact();
+        run("compacted");
+    }
+
+    void bench_build(std::vector<int> const& sorted)
+    {
+        auto run = [&](char const* name, auto build)
+        {
+            double time = measure(5, [&]
+            {
+                set<int> c = build();
+                sink = c.size();
+            });
+            set<int> c = build();
+            double find = measure(1, [&]
+            {
+                long long found = 0;
+                for (size_t i = 0; i < sorted.size(); i += sorted.size() / 256)
+                    found += c.find(sorted[i]) != c.end();
+                sink = found;
+            });
+            std::printf("%-16s %9zu elements: build %8.3f ms, 256 finds %8.3f ms\n", name, sorted.size(), time, find);
+        };
+        run("hinted insert", [&]
+        {
+            set<int> c;
+            for (int k : sorted)
+                c.insert(c.end(), k);
+            return c;
+        });
+        run("range", [&] { return set<int>(sorted.begin(), sorted.end()); });
+        run("sorted_unique", [&] { return set<int>(sorted_unique, sorted.begin(), sorted.end()); });
+    }
+
+    // The copy clones the tree, shape included, without comparing elements.
+    void bench_copy(char const* name, std::vector<int> const& keys)
+    {
+        set<int> c;
+        for (int k : keys)
+            c.insert(c.end(), k);
+        double time = measure(5, [&]
+        {
+            set<int> copy = c;
+            sink = copy.size();
+        });
+        std::printf("%-16s %9zu elements: deep copy %8.3f ms\n", name, c.size(), time);
+    }
+
+    // Moves every element from one set of strings to another and back.
+    void bench_transfer(std::vector<std::string> const& keys)
+    {
+        set<std::string> pending, active;
+        for (std::string const& k : keys)
+            pending.insert(k);
+        double erase_insert = measure(5, [&]
+        {
+            for (auto i = pending.begin(); i != pending.end();)
+            {
+                active.insert(active.end(), *i);
+                i = pending.erase(i);
+            }
+            std::swap(pending, active);
+        });
+        double extract_insert = measure(5, [&]
+        {
+            while (!pending.empty())
+                active.insert(active.end(), pending.extract(pending.begin()));
+            std::swap(pending, active);
+        });
+        double merge = measure(5, [&]
+        {
+            set<std::string> half;
+            half.insert(*pending.begin());
+            half.merge(pending);
+            pending.merge(half);
+        });
+        std::printf("%9zu elements: erase + insert %8.3f ms, extract + insert %8.3f ms, merge %8.3f ms\n",
+                    keys.size(), erase_insert, extract_insert, merge);
+    }
+
+    // Evicts the lower half of a set one element at a time, with a range
+    // erase and with erase_if.
+    void bench_evict(std::vector<int> const& keys)
+    {
+        std::vector<int> sorted = keys;
+        std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+        int watermark = sorted[sorted.size() / 2];
+        set<int> full;
+        for (int k : keys)
+            full.insert(k);
+        auto run = [&](char const* name, auto evict)
+        {
+            std::vector<set<int>> copies(5, full);
+            size_t next = 0;
+            double time = measure(5, [&]
+            {
+                set<int>& c = copies[next++];
+                evict(c);
+                sink = c.size();
+            });
+            std::printf("%-10s %9zu elements: %8.3f ms\n", name, keys.size(), time);
+        };
+        run("loop", [&](set<int>& c)
+        {
+            for (auto i = c.begin(); i != c.end() && *i < watermark;)
+                i = c.erase(i);
+        });
+        run("range", [&](set<int>& c) { c.erase(c.begin(), c.lower_bound(watermark)); });
+        run("erase_if", [&](set<int>& c) { erase_if(c, [&](int k) { return k < watermark; }); });
+    }
+
+    // Intersects and subtracts a balanced set of n elements with sets of m
+    // elements, half of them in the large set, element by element with
+    // find and erase against the set algebra.
+    void bench_algebra(size_t n, size_t m)
+    {
+        std::vector<int> keys = random_keys(n + m / 2);
+        set<int> large(keys.begin(), keys.begin() + n), small;
+        for (size_t i = 0; i != m; ++i)
+            small.insert(i % 2 ? keys[n + i / 2] : keys[i * (n / m)]);
+        double find = measure(5, [&]
+        {
+            set<int> r;
+            for (int k : small)
+                if (large.find(k) != large.end())
+                    r.insert(r.end(), k);
+            sink = r.size();
+        });
+        double intersection = measure(5, [&] { sink = set_intersection(small, large).size(); });
+        // Deep copies made outside of the timing.
+        auto copies = [&] { return std::vector<set<int>>(5, large); };
+        std::vector<set<int>> c = copies();
+        size_t next = 0;
+        double erase = measure(5, [&]
+        {
+            set<int>& to = c[next++];
+            for (int k : small)
+                to.erase(k);
+            sink = to.size();
+        });
+        c = copies();
+        next = 0;
+        double subtract = measure(5, [&]
+        {
+            set<int>& to = c[next++];
+            to.subtract(small);
+            sink = to.size();
+        });
+        std::printf("%9zu and %6zu elements: find %8.3f ms, set_intersection %8.3f ms, "
+                    "erase %8.3f ms, subtract %8.3f ms\n", n, small.size(), find, intersection, erase, subtract);
+    }
+}
+
+int main()
+{
+    for (size_t n : {size_t(1) << 10, size_t(1) << 16, size_t(1) << 20})
+    {
+        std::vector<int> keys = random_keys(n);
+        std::printf("scan\n");
+        bench_scan<set<int>>("set", keys);
+        bench_scan<threaded_set<int>>("threaded_set", keys);
+    }
+
+    for (size_t n : {size_t(1) << 16, size_t(1) << 20, size_t(1) << 22})
+    {
+        std::vector<int> keys = random_keys(n);
+        std::vector<int> queries(keys.rbegin(), keys.rend());
+        std::printf("find\n");
+        bench_find<set<int>>("set", keys, queries);
+        bench_find<set<int, std::less<int>, hugepage_allocator<int>>>("set, huge pages", keys, queries);
+    }
+
+    for (size_t n : {size_t(1) << 16, size_t(1) << 20})
+    {
+        std::vector<int> keys = random_keys(n);
+        std::vector<int> queries(keys.rbegin(), keys.rend());
+        std::vector<std::string> strings = random_strings(n);
+        std::vector<std::string> string_queries(strings.rbegin(), strings.rend());
+        std::printf("batched find\n");
+        bench_find_many("int", keys, queries);
+        bench_find_many("string", strings, string_queries);
+    }
+
+    for (size_t batch : {size_t(64), size_t(512), size_t(1) << 14})
+    {
+        std::printf("batched insert\n");
+        bench_insert_many(random_keys(size_t(1) << 21), batch);
+    }
+    for (size_t n : {size_t(1) << 12, size_t(1) << 15})
+    {
+        std::vector<int> ascending(n);
+        for (size_t i = 0; i != n; ++i)
+            ascending[i] = static_cast<int>(i);
+        std::printf("hinted insert\n");
+        bench_hint("ascending", ascending);
+        bench_hint("descending", std::vector<int>(ascending.rbegin(), ascending.rend()));
+        bench_hint("local shuffle", locally_shuffled(n));
+    }
+
+    for (size_t n : {size_t(1) << 16, size_t(1) << 20})
+    {
+        std::vector<std::string> keys = random_strings(n);
+        std::printf("find strings\n");
+        bench_strings<std::string>("set", keys);
+        bench_strings<prefixed_string>("set, prefix", keys);
+        for (std::string& k : keys)
+            k.insert(0, "https://example.com/catalogue/");
+        bench_strings<std::string>("set, long prefix", keys);
+    }
+
+    for (size_t n : {size_t(1) << 16, size_t(1) << 20})
+    {
+        std::printf("compact\n");
+        bench_compact(random_keys(n));
+    }
+
+    for (size_t n : {size_t(1) << 16, size_t(1) << 20})
+    {
+        std::vector<int> keys = random_keys(n);
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+        std::printf("build from sorted range\n");
+        bench_build(keys);
+    }
+
+    for (size_t n : {size_t(1) << 14, size_t(1) << 20})
+    {
+        std::vector<int> ascending(n);
+        for (size_t i = 0; i != n; ++i)
+            ascending[i] = static_cast<int>(i);
+        std::printf("copy\n");
+        bench_copy("random", random_keys(n));
+        bench_copy("ascending", ascending);
+    }
+
+    for (size_t n : {size_t(1) << 12, size_t(1) << 16})
+    {
+        std::printf("transfer\n");
+        bench_transfer(random_strings(n));
+    }
+
+    for (size_t n : {size_t(1) << 16, size_t(1) << 20})
+    {
+        std::printf("evict\n");
+        bench_evict(random_keys(n));
+    }
+
+    for (size_t m : {size_t(1) << 6, size_t(1) << 12, size_t(1) << 16})
+    {
+        std::printf("set algebra\n");
+        bench_algebra(size_t(1) << 20, m);
+    }
+    std::printf("%zu mappings advised with MADV_HUGEPAGE\n", hugepage_resource::instance().advised_mappings());
+}
@@ -0,0 +1,6 @@
+#include "compact_set.hpp"
+#include "counted.h"
+using container = compact_set<counted>;
+
+#include "set_testing.inl"
+#include "compact_set_features.inl"
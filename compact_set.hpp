@@ -0,0 +1,452 @@
+#ifndef COMPACT_SET
+#define COMPACT_SET
+
+#include <utility>
+#include <iterator>
+#include <cstdint>
+#include <limits>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <cassert>
+
+// Variant of set for large collections of small elements. All nodes live in
+// one growable array and are linked by 32-bit indices instead of pointers,
+// which halves the size of a set<int> node on 64-bit targets.
+//
+// Iterators hold an index and stay valid as the array grows, exactly as in
+// set. References and pointers to elements are invalidated by insert.
+template<typename T>
+struct compact_set {
+private:
+    using index = std::uint32_t;
+
+    // Slot 0 is the header: its left child is the root, so the root has
+    // parent 0 as in set. 0 can never be a child, so it also means "none".
+    static constexpr index header = 0;
+    static constexpr index none = 0;
+    // Marks unused slots in the parent field, their left links the free list.
+    static constexpr index unused = std::numeric_limits<index>::max();
+
+    struct node {
+        index left, right, parent;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+
+        T& data() noexcept {
+            return *std::launder(reinterpret_cast<T*>(&storage));
+        }
+
+        T const& data() const noexcept {
+            return *std::launder(reinterpret_cast<T const*>(&storage));
+        }
+    };
+
+    struct arena {
+        node *nodes;
+        index capacity;
+        index free;
+        size_t size;
+        compact_set const *set; // owner, which end() refers to
+    };
+
+    // The arena is kept on the heap, so that iterators survive swap.
+    arena *_arena;
+
+    static void destroy_slots(node* n, index capacity) noexcept {
+        for (index i = 1; i != capacity; ++i)
+            if (n[i].parent != unused)
+                n[i].data().~T();
+        ::operator delete(n);
+    }
+
+    static void destroy(arena* a) noexcept {
+        if (!a)
+            return;
+        destroy_slots(a->nodes, a->capacity);
+        delete a;
+    }
+
+    // Allocates `capacity` slots with the first `used` slots of `from` copied
+    // or moved into the same positions. The rest are marked unused.
+    template<bool Move>
+    static node* copy_slots(node* from, index used, index capacity) {
+        node *n = static_cast<node*>(::operator new(sizeof(node) * capacity));
+        n[header] = from ? from[header] : node{none, none, none, {}};
+
+        index i = 1;
+        try {
+            for (; i != used; ++i) {
+                n[i].left = from[i].left;
+                n[i].right = from[i].right;
+                n[i].parent = from[i].parent;
+                if (from[i].parent == unused)
+                    continue;
+                if constexpr (Move)
+                    ::new (&n[i].storage) T(std::move_if_noexcept(from[i].data()));
+                else
+                    ::new (&n[i].storage) T(from[i].data());
+            }
+        } catch (...) {
+            destroy_slots(n, i);
+            throw;
+        }
+
+        for (; i != capacity; ++i)
+            n[i].parent = unused;
+        return n;
+    }
+
+    // Returns a free slot, growing the arena if there is none. The arena
+    // object itself never moves, only the array of slots does.
+    index allocate() {
+        if (!_arena) {
+            _arena = new arena{nullptr, 1, none, 0, this};
+            try {
+                _arena->nodes = copy_slots<true>(nullptr, 1, 1);
+            } catch (...) {
+                delete _arena;
+                _arena = nullptr;
+                throw;
+            }
+        }
+
+        if (_arena->free == none) {
+            index capacity = _arena->capacity;
+            if (capacity >= unused / 2)
+                throw std::length_error("compact_set is too large");
+            index grown = capacity < 8 ? 9 : capacity * 2;
+            node *n = copy_slots<true>(_arena->nodes, capacity, grown);
+            destroy_slots(_arena->nodes, capacity);
+            _arena->nodes = n;
+            _arena->capacity = grown;
+            for (index i = grown; i-- > capacity;) {
+                n[i].left = _arena->free;
+                _arena->free = i;
+            }
+        }
+
+        index i = _arena->free;
+        _arena->free = _arena->nodes[i].left;
+        return i;
+    }
+
+    void deallocate(index i) noexcept {
+        node &v = _arena->nodes[i];
+        v.parent = unused;
+        v.left = _arena->free;
+        _arena->free = i;
+    }
+
+    node* nodes() const noexcept {
+        return _arena ? _arena->nodes : nullptr;
+    }
+
+    index root() const noexcept {
+        return _arena ? _arena->nodes[header].left : none;
+    }
+public:
+    struct iterator: public std::iterator<std::bidirectional_iterator_tag, T const> {
+        iterator() noexcept: owner(nullptr), i(header) {}
+
+        T const& operator*() const {
+            return elements()->nodes[i].data();
+        }
+
+        T const* operator->() const {
+            return &elements()->nodes[i].data();
+        }
+
+        iterator operator++() {
+            arena const *a = elements();
+            node const *n = a->nodes;
+            if (n[i].right) {
+                i = n[i].right;
+                while (n[i].left)
+                    i = n[i].left;
+            } else {
+                index w = i;
+                i = n[i].parent;
+                while (i != header && n[i].right == w) {
+                    w = i;
+                    i = n[i].parent;
+                }
+            }
+
+            if (i == header)
+                owner = a->set;
+            return *this;
+        }
+
+        iterator operator--() {
+            if (i == header)
+                owner = static_cast<compact_set const*>(owner)->_arena;
+            node const *n = elements()->nodes;
+            if (n[i].left) {
+                i = n[i].left;
+                while (n[i].right)
+                    i = n[i].right;
+            } else {
+                index w = i;
+                i = n[i].parent;
+                while (i != header && n[i].left == w) {
+                    w = i;
+                    i = n[i].parent;
+                }
+            }
+
+            return *this;
+        }
+
+        iterator const operator++(int) {
+            iterator other = *this;
+            ++*this;
+            return other;
+        }
+
+        iterator const operator--(int) {
+            iterator other = *this;
+            --*this;
+            return other;
+        }
+
+        friend bool operator==(iterator const& a, iterator const& b) noexcept {
+            return a.owner == b.owner && a.i == b.i;
+        }
+
+        friend bool operator!=(iterator const& a, iterator const& b) noexcept {
+            return !(a == b);
+        }
+    private:
+        iterator(void const* owner, index i) noexcept: owner(owner), i(i) {}
+
+        arena const* elements() const noexcept {
+            return static_cast<arena const*>(owner);
+        }
+
+        // The arena for elements, which move along with it on swap. The set
+        // for end(), which so stays the same while the arena comes and goes.
+        void const *owner;
+        index i;
+
+        friend struct compact_set;
+    };
+
+    using const_iterator = iterator;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = reverse_iterator;
+
+    compact_set() noexcept: _arena(nullptr) {
+    }
+
+    // Copies the arena slot by slot, without comparisons.
+    compact_set(compact_set const& other): _arena(nullptr) {
+        if (!other._arena)
+            return;
+        arena const &a = *other._arena;
+        _arena = new arena{nullptr, a.capacity, a.free, a.size, this};
+        try {
+            _arena->nodes = copy_slots<false>(a.nodes, a.capacity, a.capacity);
+        } catch (...) {
+            delete _arena;
+            throw;
+        }
+    }
+
+    compact_set& operator=(compact_set other) noexcept {
+        swap(*this, other);
+        return *this;
+    }
+
+    ~compact_set() {
+        destroy(_arena);
+    }
+
+    const_iterator begin() const noexcept {
+        index i = header;
+        node const *n = nodes();
+        if (n)
+            while (n[i].left)
+                i = n[i].left;
+        return at(i);
+    }
+
+    const_iterator cbegin() const noexcept {
+        return begin();
+    }
+
+    const_iterator end() const noexcept {
+        return iterator(this, header);
+    }
+
+    const_iterator cend() const noexcept {
+        return end();
+    }
+
+    const_reverse_iterator rbegin() const noexcept {
+        return std::make_reverse_iterator(end());
+    }
+    const_reverse_iterator crbegin() const noexcept {
+        return rbegin();
+    }
+    const_reverse_iterator rend() const noexcept {
+        return std::make_reverse_iterator(begin());
+    }
+    const_reverse_iterator crend() const noexcept {
+        return rend();
+    }
+
+    std::pair<iterator, bool> insert(T const& value) {
+        index v = root(), p = header;
+        bool left = true;
+
+        while (v) {
+            node const &n = _arena->nodes[v];
+            p = v;
+            if (value < n.data()) {
+                v = n.left;
+                left = true;
+            } else if (n.data() < value) {
+                v = n.right;
+                left = false;
+            } else {
+                return std::make_pair(iterator(_arena, v), false);
+            }
+        }
+
+        v = allocate();
+        node &n = _arena->nodes[v];
+        try {
+            ::new (&n.storage) T(value);
+        } catch (...) {
+            deallocate(v);
+            throw;
+        }
+        n.left = n.right = none;
+        n.parent = p;
+        if (left)
+            _arena->nodes[p].left = v;
+        else
+            _arena->nodes[p].right = v;
+        _arena->size++;
+        return std::make_pair(iterator(_arena, v), true);
+    }
+
+    const_iterator find(T const& value) const {
+        node const *n = nodes();
+        index v = root();
+
+        while (v) {
+            if (value < n[v].data()) {
+                v = n[v].left;
+            } else if (n[v].data() < value) {
+                v = n[v].right;
+            } else {
+                return iterator(_arena, v);
+            }
+        }
+
+        return end();
+    }
+
+    const_iterator lower_bound(T const& value) const {
+        node const *n = nodes();
+        index v = root(), result = header;
+
+        while (v) {
+            if (n[v].data() < value) {
+                v = n[v].right;
+            } else {
+                result = v;
+                v = n[v].left;
+            }
+        }
+
+        return at(result);
+    }
+
+    const_iterator upper_bound(T const& value) const {
+        node const *n = nodes();
+        index v = root(), result = header;
+
+        while (v) {
+            if (value < n[v].data()) {
+                result = v;
+                v = n[v].left;
+            } else {
+                v = n[v].right;
+            }
+        }
+
+        return at(result);
+    }
+
+    iterator erase(const_iterator it) {
+        iterator result = it;
+        ++result;
+
+        node *n = _arena->nodes;
+        index v = it.i;
+        index p = n[v].parent;
+        auto relink = [&](index from, index to) {
+            if (n[p].left == from)
+                n[p].left = to;
+            else
+                n[p].right = to;
+        };
+
+        if (!n[v].left || !n[v].right) {
+            index child = n[v].left ? n[v].left : n[v].right;
+            relink(v, child);
+            if (child)
+                n[child].parent = p;
+        } else {
+            index next = result.i;
+            assert(!n[next].left);
+            if (n[next].parent != v) {
+                index np = n[next].parent;
+                n[np].left = n[next].right;
+                if (n[next].right)
+                    n[n[next].right].parent = np;
+                n[next].right = n[v].right;
+                n[n[v].right].parent = next;
+            }
+            n[next].left = n[v].left;
+            n[n[v].left].parent = next;
+            n[next].parent = p;
+            relink(v, next);
+        }
+
+        n[v].data().~T();
+        deallocate(v);
+        _arena->size--;
+
+        return result;
+    }
+
+    size_t size() const {
+        return _arena ? _arena->size : 0;
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    void clear() {
+        destroy(_arena);
+        _arena = nullptr;
+    }
+
+    friend void swap(compact_set& a, compact_set& b) {
+        std::swap(a._arena, b._arena);
+        if (a._arena)
+            a._arena->set = &a;
+        if (b._arena)
+            b._arena->set = &b;
+    }
+private:
+    iterator at(index i) const noexcept {
+        return i == header ? end() : iterator(_arena, i);
+    }
+};
+
+#endif // COMPACT_SET
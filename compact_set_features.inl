@@ -0,0 +1,93 @@
+// Tests of compact_set behaviour which is not a part of the common
+// container interface checked by set_testing.inl.
+
+TEST(features, iterators_survive_growth)
+{
+counted::no_new_instances_guard g;
+
+container c;
+mass_insert(c, {500, 250});
+container::iterator i = c.begin();
+container::iterator e = c.end();
+for (int k = 0; k != 1000; ++k)
+    c.insert(k * 7 % 1000);
+EXPECT_EQ(250, *i);
+EXPECT_EQ(251, *++i);
+EXPECT_EQ(999, *--e);
+EXPECT_EQ(c.end(), ++e);
+EXPECT_EQ(1000u, c.size());
+}
+
+TEST(features, end_is_stable)
+{
+counted::no_new_instances_guard g;
+
+container c;
+container::iterator e = c.end();
+c.insert(1);
+EXPECT_EQ(e, ++c.begin());
+c.clear();
+EXPECT_EQ(e, c.end());
+c.insert(2);
+EXPECT_EQ(2, *--container::iterator(e));
+container c2;
+mass_insert(c2, {3, 4});
+c = c2;
+EXPECT_EQ(e, c.end());
+EXPECT_EQ(4, *--container::iterator(e));
+
+container::iterator i = c.find(4);
+swap(c, c2);
+EXPECT_EQ(e, c.end());
+EXPECT_EQ(c2.end(), ++i);
+}
+
+TEST(features, erased_slots_reused)
+{
+counted::no_new_instances_guard g;
+
+container c;
+for (int k = 0; k != 100; ++k)
+    c.insert(k * 37 % 100);
+for (int k = 0; k != 100; k += 2)
+    c.erase(c.find(k));
+counted const* first = &*c.begin();
+for (int k = 0; k != 100; k += 2)
+    c.insert(k);
+EXPECT_EQ(first, &*c.find(1));
+EXPECT_EQ(100u, c.size());
+}
+
+TEST(features, copy_keeps_shape)
+{
+counted::no_new_instances_guard g;
+
+container c;
+mass_insert(c, {5, 3, 8, 1, 4, 7, 9});
+container c2 = c;
+c.erase(c.find(5));
+c2.insert(6);
+expect_eq(c, {1, 3, 4, 7, 8, 9});
+expect_eq(c2, {1, 3, 4, 5, 6, 7, 8, 9});
+}
+
+TEST(fault_injection, growth)
+{
+faulty_run([]
+{
+container c;
+mass_insert(c, {1, 2, 3, 4, 5, 6, 7, 8});
+try
+{
+c.insert(9);
+}
+catch (...)
+{
+fault_injection_disable dg;
+expect_eq(c, {1, 2, 3, 4, 5, 6, 7, 8});
+throw;
+}
+fault_injection_disable dg;
+expect_eq(c, {1, 2, 3, 4, 5, 6, 7, 8, 9});
+});
+}
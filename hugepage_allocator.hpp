@@ -0,0 +1,152 @@
+#ifndef HUGEPAGE_ALLOCATOR
+#define HUGEPAGE_ALLOCATOR
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <new>
+
+#include <sys/mman.h>
+
+// Process-wide source of memory backed by transparent huge pages. Memory is
+// carved out of 2 MiB-aligned anonymous mappings advised with MADV_HUGEPAGE;
+// a mapping is returned to the system once everything allocated from it has
+// been freed.
+//
+// When the kernel has no THP support madvise fails and the mapping simply
+// stays on normal pages, so the only difference is the TLB footprint.
+struct hugepage_resource {
+    static constexpr size_t huge_page = size_t(2) << 20;
+
+    // Never destroyed, so that sets with static storage duration can still
+    // free their nodes at exit.
+    static hugepage_resource& instance() {
+        static hugepage_resource *result = new hugepage_resource();
+        return *result;
+    }
+
+    void* allocate(size_t bytes, size_t align) {
+        std::lock_guard<std::mutex> lock(m);
+
+        if (current) {
+            uintptr_t p = (current->first + current->second.used + align - 1) & ~(uintptr_t(align) - 1);
+            if (p + bytes <= current->first + current->second.size) {
+                current->second.used = p + bytes - current->first;
+                current->second.live += bytes;
+                return reinterpret_cast<void*>(p);
+            }
+        }
+
+        size_t size = (bytes + huge_page - 1) / huge_page * huge_page;
+        uintptr_t p = map(size);
+        auto *previous = current;
+        try {
+            current = &*regions.emplace(p, region{size, bytes, bytes}).first;
+        } catch (...) {
+            munmap(reinterpret_cast<void*>(p), size);
+            throw;
+        }
+
+        // An empty region was kept only because it was current; once it is
+        // replaced nothing would ever free it.
+        if (previous && previous->second.live == 0) {
+            munmap(reinterpret_cast<void*>(previous->first), previous->second.size);
+            regions.erase(previous->first);
+        }
+        return reinterpret_cast<void*>(p);
+    }
+
+    void deallocate(void* ptr, size_t bytes) noexcept {
+        std::lock_guard<std::mutex> lock(m);
+
+        auto it = std::prev(regions.upper_bound(reinterpret_cast<uintptr_t>(ptr)));
+        it->second.live -= bytes;
+        if (it->second.live != 0)
+            return;
+
+        if (&*it == current) {
+            it->second.used = 0;
+        } else {
+            munmap(reinterpret_cast<void*>(it->first), it->second.size);
+            regions.erase(it);
+        }
+    }
+
+    // Number of mappings currently held.
+    size_t mappings() const {
+        std::lock_guard<std::mutex> lock(m);
+        return regions.size();
+    }
+
+    // Number of mappings the kernel accepted MADV_HUGEPAGE for.
+    size_t advised_mappings() const noexcept {
+        return advised;
+    }
+
+    hugepage_resource(hugepage_resource const&) = delete;
+    hugepage_resource& operator=(hugepage_resource const&) = delete;
+private:
+    struct region {
+        size_t size, used, live;
+    };
+
+    hugepage_resource() = default;
+
+    // Maps `size` bytes aligned to a huge page: the mapping is over-allocated
+    // by one huge page and the unaligned head and tail are unmapped.
+    uintptr_t map(size_t size) {
+        void *raw = mmap(nullptr, size + huge_page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw == MAP_FAILED)
+            throw std::bad_alloc();
+
+        uintptr_t begin = reinterpret_cast<uintptr_t>(raw);
+        uintptr_t aligned = (begin + huge_page - 1) & ~(uintptr_t(huge_page) - 1);
+        if (aligned != begin)
+            munmap(raw, aligned - begin);
+        munmap(reinterpret_cast<void*>(aligned + size), begin + huge_page - aligned);
+
+#ifdef MADV_HUGEPAGE
+        if (madvise(reinterpret_cast<void*>(aligned), size, MADV_HUGEPAGE) == 0)
+            ++advised;
+#endif
+        return aligned;
+    }
+
+    mutable std::mutex m;
+    std::map<uintptr_t, region> regions;
+    std::pair<uintptr_t const, region> *current = nullptr;
+    size_t advised = 0;
+};
+
+// Stateless allocator over hugepage_resource. With
+// set<T, std::less<T>, hugepage_allocator<T>> the node slabs of every set come
+// from huge pages.
+template<typename T>
+struct hugepage_allocator {
+    using value_type = T;
+
+    hugepage_allocator() noexcept = default;
+
+    template<typename U>
+    hugepage_allocator(hugepage_allocator<U> const&) noexcept {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(hugepage_resource::instance().allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, size_t n) noexcept {
+        hugepage_resource::instance().deallocate(p, n * sizeof(T));
+    }
+
+    friend bool operator==(hugepage_allocator const&, hugepage_allocator const&) noexcept {
+        return true;
+    }
+
+    friend bool operator!=(hugepage_allocator const&, hugepage_allocator const&) noexcept {
+        return false;
+    }
+};
+
+#endif // HUGEPAGE_ALLOCATOR
@@ -0,0 +1,7 @@
+#include "set.hpp"
+#include "hugepage_allocator.hpp"
+#include "counted.h"
+using container = set<counted, std::less<counted>, hugepage_allocator<counted>>;
+
+#include "set_testing.inl"
+#include "hugepage_set_features.inl"
@@ -0,0 +1,42 @@
+// Tests of set over hugepage_allocator which are not a part of the common
+// container interface checked by set_testing.inl.
+
+TEST(features, nodes_in_huge_page)
+{
+counted::no_new_instances_guard g;
+
+container c;
+mass_insert(c, {5, 3, 8, 1, 4, 7, 9});
+uintptr_t first = reinterpret_cast<uintptr_t>(&*c.begin()) & ~(uintptr_t(hugepage_resource::huge_page) - 1);
+for (auto const& e : c)
+    EXPECT_EQ(first, reinterpret_cast<uintptr_t>(&e) & ~(uintptr_t(hugepage_resource::huge_page) - 1));
+}
+
+TEST(features, memory_reused)
+{
+counted::no_new_instances_guard g;
+
+counted const* first;
+{
+    container c;
+    c.insert(1);
+    first = &*c.begin();
+}
+container c;
+c.insert(2);
+EXPECT_EQ(first, &*c.begin());
+}
+
+TEST(features, empty_region_unmapped)
+{
+hugepage_allocator<char> a;
+char *p = a.allocate(hugepage_resource::huge_page + 1);
+size_t mapped = hugepage_resource::instance().mappings();
+a.deallocate(p, hugepage_resource::huge_page + 1);
+
+// Does not fit in the emptied region, which must be unmapped rather than
+// leaked when the new region takes its place.
+char *q = a.allocate(3 * hugepage_resource::huge_page);
+EXPECT_EQ(mapped, hugepage_resource::instance().mappings());
+a.deallocate(q, 3 * hugepage_resource::huge_page);
+}
@@ -2,4 +2,5 @@
 #include "counted.h"
 using container = set<counted>;
 
-#include "set_testing.inl"
\ No newline at end of file
+#include "set_testing.inl"
+#include "set_features.inl"
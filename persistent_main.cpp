@@ -0,0 +1,6 @@
+#include "persistent_set.hpp"
+#include "counted.h"
+using container = persistent_set<counted>;
+
+#include "set_testing.inl"
+#include "persistent_set_features.inl"
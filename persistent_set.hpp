@@ -0,0 +1,415 @@
+#ifndef PERSISTENT_SET
+#define PERSISTENT_SET
+
+#include <utility>
+#include <iterator>
+#include <vector>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+
+// Persistent variant of set: nodes are immutable and shared between versions.
+// insert and erase copy only the path from the root to the changed node, so
+// taking a snapshot is O(1). A version is reclaimed as soon as the last set
+// or iterator referring to it goes away.
+//
+// The tree is a treap: every node has a pseudo-random priority, no lower than
+// the ones of its children. Its shape then does not depend on the order of
+// the inserts, and the paths copied are O(log n) long in expectation, sorted
+// input included. Teardown recurses as deep as the tree, which stays shallow
+// for the same reason.
+template<typename T>
+struct persistent_set {
+private:
+    struct node {
+        T data;
+        node const *left, *right;
+        std::uint64_t priority;
+        mutable std::atomic<size_t> refs;
+
+        node() = delete;
+        node(T const& value, std::uint64_t priority, node const* left, node const* right)
+            : data(value), left(left), right(right), priority(priority), refs(1) {
+            acquire(left);
+            acquire(right);
+        }
+
+        ~node() {
+            release(left);
+            release(right);
+        }
+    };
+
+    static node const* acquire(node const* v) noexcept {
+        if (v)
+            v->refs.fetch_add(1, std::memory_order_relaxed);
+        return v;
+    }
+
+    static void release(node const* v) noexcept {
+        if (v && v->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            delete v;
+    }
+
+    // Successive values of a counter scrambled by splitmix64.
+    static std::uint64_t next_priority() noexcept {
+        static std::atomic<std::uint64_t> counter{0};
+        std::uint64_t x = counter.fetch_add(0x9e3779b97f4a7c15, std::memory_order_relaxed);
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+        return x ^ (x >> 31);
+    }
+
+    // The functions below return new references and take over the ones
+    // passed as `left`, `right` or `child`, also if an exception is thrown.
+    // The nodes they get otherwise are only borrowed.
+
+    // Copy of v with other children.
+    static node const* copy(node const* v, node const* left, node const* right) {
+        node const *result;
+        try {
+            result = new node(v->data, v->priority, left, right);
+        } catch (...) {
+            release(left);
+            release(right);
+            throw;
+        }
+        release(left);
+        release(right);
+        return result;
+    }
+
+    // Copy of t with `child` in place of the subtree on the `left` side.
+    static node const* replace_child(node const* t, bool left, node const* child) {
+        return left ? copy(t, child, acquire(t->right)) : copy(t, acquire(t->left), child);
+    }
+
+    // Splits t, which does not have value, into the elements less than and
+    // greater than value.
+    static std::pair<node const*, node const*> split(node const* t, T const& value) {
+        if (!t)
+            return {nullptr, nullptr};
+
+        bool left = value < t->data;
+        std::pair<node const*, node const*> parts = split(left ? t->left : t->right, value);
+        node const *&inner = left ? parts.second : parts.first;
+        node const *&outer = left ? parts.first : parts.second;
+        try {
+            inner = replace_child(t, left, inner);
+        } catch (...) {
+            release(outer);
+            throw;
+        }
+        return parts;
+    }
+
+    // Adds a node for value, which t does not have, with the given priority.
+    static node const* insert(node const* t, T const& value, std::uint64_t priority) {
+        if (!t || priority > t->priority) {
+            std::pair<node const*, node const*> parts = split(t, value);
+            node const *result;
+            try {
+                result = new node(value, priority, parts.first, parts.second);
+            } catch (...) {
+                release(parts.first);
+                release(parts.second);
+                throw;
+            }
+            release(parts.first);
+            release(parts.second);
+            return result;
+        }
+
+        bool left = value < t->data;
+        return replace_child(t, left, insert(left ? t->left : t->right, value, priority));
+    }
+
+    // Joins a and b, all elements of a being less than those of b.
+    static node const* join(node const* a, node const* b) {
+        if (!a || !b)
+            return acquire(a ? a : b);
+        if (a->priority > b->priority)
+            return replace_child(a, false, join(a->right, b));
+        return replace_child(b, true, join(a, b->left));
+    }
+
+    // Removes value, which t has.
+    static node const* erase(node const* t, T const& value) {
+        assert(t);
+        if (value < t->data)
+            return replace_child(t, true, erase(t->left, value));
+        if (t->data < value)
+            return replace_child(t, false, erase(t->right, value));
+        return join(t->left, t->right);
+    }
+
+    static std::vector<node const*> lower_bound_path(node const* t, T const& value) {
+        std::vector<node const*> path;
+        size_t found = 0;
+
+        for (node const *v = t; v;) {
+            path.push_back(v);
+            if (v->data < value) {
+                v = v->right;
+            } else {
+                found = path.size();
+                v = v->left;
+            }
+        }
+
+        path.resize(found);
+        return path;
+    }
+
+    node const *root;
+    size_t _size;
+public:
+    struct iterator: public std::iterator<std::bidirectional_iterator_tag, T const> {
+        iterator() noexcept: root(nullptr), path() {}
+
+        iterator(iterator const& other): root(acquire(other.root)), path(other.path) {}
+
+        iterator(iterator&& other) noexcept: root(other.root), path(std::move(other.path)) {
+            other.root = nullptr;
+        }
+
+        iterator& operator=(iterator other) noexcept {
+            std::swap(root, other.root);
+            std::swap(path, other.path);
+            return *this;
+        }
+
+        ~iterator() {
+            release(root);
+        }
+
+        T const& operator*() const {
+            return path.back()->data;
+        }
+
+        T const* operator->() const {
+            return &path.back()->data;
+        }
+
+        iterator operator++() {
+            node const *v = path.back();
+            if (v->right) {
+                path.push_back(v->right);
+                while (path.back()->left)
+                    path.push_back(path.back()->left);
+            } else {
+                path.pop_back();
+                while (!path.empty() && path.back()->right == v) {
+                    v = path.back();
+                    path.pop_back();
+                }
+            }
+
+            return *this;
+        }
+
+        iterator operator--() {
+            if (path.empty()) {
+                path.push_back(root);
+                while (path.back()->right)
+                    path.push_back(path.back()->right);
+            } else if (path.back()->left) {
+                path.push_back(path.back()->left);
+                while (path.back()->right)
+                    path.push_back(path.back()->right);
+            } else {
+                node const *v = path.back();
+                path.pop_back();
+                while (!path.empty() && path.back()->left == v) {
+                    v = path.back();
+                    path.pop_back();
+                }
+            }
+
+            return *this;
+        }
+
+        iterator const operator++(int) {
+            iterator other = *this;
+            ++*this;
+            return other;
+        }
+
+        iterator const operator--(int) {
+            iterator other = *this;
+            --*this;
+            return other;
+        }
+
+        friend bool operator==(iterator const& a, iterator const& b) noexcept {
+            return a.current() == b.current();
+        }
+
+        friend bool operator!=(iterator const& a, iterator const& b) noexcept {
+            return a.current() != b.current();
+        }
+    private:
+        iterator(node const* root, std::vector<node const*> path): root(acquire(root)), path(std::move(path)) {}
+
+        node const* current() const noexcept {
+            return path.empty() ? nullptr : path.back();
+        }
+
+        // Keeps the version the iterator points into alive.
+        node const *root;
+        std::vector<node const*> path;
+
+        friend struct persistent_set;
+    };
+
+    using const_iterator = iterator;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = reverse_iterator;
+
+    persistent_set() noexcept: root(nullptr), _size(0) {
+    }
+
+    persistent_set(persistent_set const& other) noexcept: root(acquire(other.root)), _size(other._size) {
+    }
+
+    persistent_set& operator=(persistent_set other) noexcept {
+        swap(*this, other);
+        return *this;
+    }
+
+    ~persistent_set() {
+        release(root);
+    }
+
+    // O(1) point-in-time copy which is not affected by further changes of *this.
+    persistent_set snapshot() const noexcept {
+        return *this;
+    }
+
+    const_iterator begin() const {
+        std::vector<node const*> path;
+        for (node const *v = root; v; v = v->left)
+            path.push_back(v);
+        return iterator(root, std::move(path));
+    }
+
+    const_iterator cbegin() const {
+        return begin();
+    }
+
+    const_iterator end() const {
+        return iterator(root, {});
+    }
+
+    const_iterator cend() const {
+        return end();
+    }
+
+    const_reverse_iterator rbegin() const {
+        return std::make_reverse_iterator(end());
+    }
+    const_reverse_iterator crbegin() const {
+        return rbegin();
+    }
+    const_reverse_iterator rend() const {
+        return std::make_reverse_iterator(begin());
+    }
+    const_reverse_iterator crend() const {
+        return rend();
+    }
+
+    std::pair<iterator, bool> insert(T const& value) {
+        iterator found = find(value);
+        if (found != end())
+            return std::make_pair(std::move(found), false);
+
+        iterator result = commit(insert(root, value, next_priority()), value);
+        _size++;
+        return std::make_pair(std::move(result), true);
+    }
+
+    const_iterator find(T const& value) const {
+        std::vector<node const*> path;
+        node const *v = root;
+
+        while (v) {
+            path.push_back(v);
+            if (value < v->data) {
+                v = v->left;
+            } else if (v->data < value) {
+                v = v->right;
+            } else {
+                return iterator(root, std::move(path));
+            }
+        }
+
+        return end();
+    }
+
+    const_iterator lower_bound(T const& value) const {
+        return iterator(root, lower_bound_path(root, value));
+    }
+
+    const_iterator upper_bound(T const& value) const {
+        std::vector<node const*> path;
+        size_t found = 0;
+
+        for (node const *v = root; v;) {
+            path.push_back(v);
+            if (value < v->data) {
+                found = path.size();
+                v = v->left;
+            } else {
+                v = v->right;
+            }
+        }
+
+        path.resize(found);
+        return iterator(root, std::move(path));
+    }
+
+    // `it` may also come from an older version which has the same element.
+    // It keeps that version, and so *it, alive.
+    iterator erase(const_iterator it) {
+        iterator result = commit(erase(root, *it), *it);
+        _size--;
+        return result;
+    }
+
+    size_t size() const {
+        return _size;
+    }
+
+    bool empty() const {
+        return _size == 0;
+    }
+
+    void clear() {
+        release(root);
+        root = nullptr;
+        _size = 0;
+    }
+
+    friend void swap(persistent_set& a, persistent_set& b) {
+        std::swap(a.root, b.root);
+        std::swap(a._size, b._size);
+    }
+private:
+    // Makes top, a changed version of the tree, the current one and returns
+    // the iterator at the first element not less than value. Nothing changes
+    // if an exception is thrown.
+    iterator commit(node const* top, T const& value) {
+        std::vector<node const*> path;
+        try {
+            path = lower_bound_path(top, value);
+        } catch (...) {
+            release(top);
+            throw;
+        }
+        release(root);
+        root = top;
+        return iterator(root, std::move(path));
+    }
+};
+
+#endif // PERSISTENT_SET
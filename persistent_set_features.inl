@@ -0,0 +1,125 @@
+// Tests of persistent_set behaviour which is not a part of the common
+// container interface checked by set_testing.inl.
+
+TEST(features, snapshot)
+{
+counted::no_new_instances_guard g;
+
+container c;
+mass_insert(c, {5, 3, 8, 1, 4, 7, 9});
+container s = c.snapshot();
+c.insert(6);
+c.erase(c.find(5));
+c.erase(c.find(1));
+expect_eq(s, {1, 3, 4, 5, 7, 8, 9});
+expect_eq(c, {3, 4, 6, 7, 8, 9});
+}
+
+TEST(features, snapshot_is_free)
+{
+counted::no_new_instances_guard g;
+
+container c;
+mass_insert(c, {5, 3, 8, 1, 4, 7, 9});
+{
+    counted::no_new_instances_guard g2;
+    container s = c.snapshot();
+    container s2;
+    s2 = s.snapshot();
+    g2.expect_no_instances();
+}
+}
+
+TEST(features, old_versions_reclaimed)
+{
+counted::no_new_instances_guard g;
+
+container c;
+{
+    container s;
+    mass_insert(c, {5, 3, 8, 1, 4, 7, 9});
+    s = c.snapshot();
+    c.erase(c.find(3));
+    c.insert(2);
+}
+c.clear();
+g.expect_no_instances();
+}
+
+TEST(features, iterate_while_writing)
+{
+counted::no_new_instances_guard g;
+
+container c;
+mass_insert(c, {5, 3, 8, 1, 4, 7, 9});
+container s = c.snapshot();
+std::vector<int> seen;
+for (container::iterator i = s.begin(); i != s.end(); ++i)
+{
+    seen.push_back(*i);
+    c.erase(c.begin());
+    c.insert(*i + 10);
+}
+EXPECT_EQ((std::vector<int>{1, 3, 4, 5, 7, 8, 9}), seen);
+expect_eq(c, {11, 13, 14, 15, 17, 18, 19});
+}
+
+TEST(features, iterator_keeps_version)
+{
+counted::no_new_instances_guard g;
+
+container::iterator i;
+{
+    container c;
+    mass_insert(c, {5, 3, 8, 1, 4});
+    i = c.find(3);
+    c.erase(i);
+}
+EXPECT_EQ(3, *i);
+EXPECT_EQ(4, *++i);
+EXPECT_EQ(5, *++i);
+}
+
+TEST(features, erase_two_children)
+{
+counted::no_new_instances_guard g;
+
+container c;
+mass_insert(c, {10, 5, 20, 15, 25, 12, 17, 11});
+container s = c.snapshot();
+container::iterator i = c.erase(c.find(10));
+EXPECT_EQ(11, *i);
+i = c.erase(c.find(20));
+EXPECT_EQ(25, *i);
+i = c.erase(c.find(25));
+EXPECT_EQ(c.end(), i);
+expect_eq(c, {5, 11, 12, 15, 17});
+expect_eq(s, {5, 10, 11, 12, 15, 17, 20, 25});
+}
+
+// Paths copied stay short whatever the order of the inserts.
+TEST(features, sorted_input)
+{
+int const n = 1 << 16;
+persistent_set<int> c;
+for (int i = 0; i != n; ++i)
+    c.insert(i);
+persistent_set<int> s = c.snapshot();
+for (int i = 0; i != n / 2; ++i)
+    c.erase(c.begin());
+for (int i = n; i-- > n / 4 * 3;)
+    c.erase(c.find(i));
+EXPECT_EQ(size_t(n / 4), c.size());
+EXPECT_EQ(n / 2, *c.begin());
+EXPECT_EQ(n / 4 * 3 - 1, *c.rbegin());
+
+EXPECT_EQ(size_t(n), s.size());
+int expected = 0;
+for (int x : s)
+{
+    if (x != expected)
+        break;
+    ++expected;
+}
+EXPECT_EQ(n, expected);
+}
@@ -6,33 +6,1246 @@
 #include <iterator>
 #include <optional>
 #include <cassert>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <new>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <typeinfo>
+#include <functional>
+#include <string>
+#include <vector>
 
+// Customization point for set::memory_breakdown(): specialize it with
+//   size_t operator()(T const&) const noexcept
+// returning the bytes of heap memory owned by a value, sizeof(T) excluded.
+// Without a specialization elements are assumed to own none.
 template<typename T>
+struct set_heap_usage {};
+
+// Customization point for keys whose comparison is expensive: specialize it
+// with
+//   std::uint64_t operator()(T const&) const noexcept
+// returning a prefix of the key such that prefix(a) < prefix(b) implies
+// a < b, and a < b implies prefix(a) <= prefix(b). Nodes then keep the
+// prefix next to their links, and most comparisons are decided by it without
+// touching the key itself.
+template<typename T>
+struct set_key_prefix {};
+
+// Customization point for keys whose comparison is expensive: specialize it
+// with
+//   int operator()(T const& a, T const& b) const
+// returning a negative number, zero or a positive one as a is less than,
+// equivalent to or greater than b by operator<. Searches then compare once
+// per level of the tree instead of twice. std::string uses its compare().
+template<typename T>
+struct set_three_way {};
+
+template<typename C, typename Traits, typename A>
+struct set_three_way<std::basic_string<C, Traits, A>> {
+    int operator()(std::basic_string<C, Traits, A> const& a, std::basic_string<C, Traits, A> const& b) const noexcept {
+        return a.compare(b);
+    }
+};
+
+// Prefix of a byte string ordered as by memcmp, std::string for instance:
+// the first 8 bytes as a big-endian number, padded with zeros.
+inline std::uint64_t set_bytes_prefix(char const* data, size_t size) noexcept {
+    std::uint64_t result = 0;
+    for (size_t i = 0; i != 8; ++i)
+        result = result << 8 | (i < size ? static_cast<unsigned char>(data[i]) : 0);
+    return result;
+}
+
+#ifdef SET_MEMORY_REGISTRY
+// Footprint of all live sets, one entry per instantiation of set. Built only
+// with SET_MEMORY_REGISTRY defined; the counters are updated as nodes and
+// slabs come and go, so reading them costs nothing to the sets.
+struct set_memory_registry {
+    struct entry {
+        char const *name;
+        std::atomic<size_t> sets{0}, nodes{0}, bytes{0};
+        entry *next;
+
+        explicit entry(char const* name) noexcept: name(name), next(head().load(std::memory_order_relaxed)) {
+            while (!head().compare_exchange_weak(next, this, std::memory_order_release, std::memory_order_relaxed)) {
+            }
+        }
+
+        entry(entry const&) = delete;
+        entry& operator=(entry const&) = delete;
+    };
+
+    // Calls f(entry const&) for every instantiation which has been used.
+    template<typename F>
+    static void for_each(F f) {
+        for (entry const *e = head().load(std::memory_order_acquire); e; e = e->next)
+            f(*e);
+    }
+private:
+    static std::atomic<entry*>& head() noexcept {
+        static std::atomic<entry*> result{nullptr};
+        return result;
+    }
+};
+#endif
+
+// Destroys trees detached by set::clear_async() on a background thread. The
+// thread is started by the first clear_async() and finishes the remaining
+// work at exit.
+struct set_reclaimer {
+    struct task {
+        task *next = nullptr;
+
+        virtual void run() noexcept = 0;
+        virtual ~task() = default;
+    };
+
+    static set_reclaimer& instance() {
+        static set_reclaimer result;
+        return result;
+    }
+
+    // Queues t to be run and deleted on the background thread. Returns false,
+    // leaving t to the caller, if the thread could not be started.
+    bool post(task* t) noexcept {
+        std::lock_guard<std::mutex> lock(m);
+        if (!worker.joinable()) {
+            try {
+                worker = std::thread([this] { work(); });
+            } catch (...) {
+                return false;
+            }
+        }
+
+        t->next = nullptr;
+        (head ? tail->next : head) = t;
+        tail = t;
+        pending.notify_one();
+        return true;
+    }
+
+    // Blocks until everything posted so far has been run.
+    void wait() {
+        std::unique_lock<std::mutex> lock(m);
+        idle.wait(lock, [this] { return !head && !busy; });
+    }
+
+    set_reclaimer(set_reclaimer const&) = delete;
+    set_reclaimer& operator=(set_reclaimer const&) = delete;
+
+    ~set_reclaimer() {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            stop = true;
+        }
+        pending.notify_one();
+        if (worker.joinable())
+            worker.join();
+    }
+private:
+    set_reclaimer() = default;
+
+    void work() noexcept {
+        std::unique_lock<std::mutex> lock(m);
+        for (;;) {
+            pending.wait(lock, [this] { return head || stop; });
+            if (!head)
+                return;
+
+            task *t = head;
+            head = t->next;
+            busy = true;
+            lock.unlock();
+            t->run();
+            delete t;
+            lock.lock();
+            busy = false;
+            if (!head)
+                idle.notify_all();
+        }
+    }
+
+    std::mutex m;
+    std::condition_variable pending, idle;
+    task *head = nullptr, *tail = nullptr;
+    bool busy = false, stop = false;
+    std::thread worker;
+};
+
+// Tells set that a range is sorted and has no duplicates.
+struct sorted_unique_t {
+    explicit sorted_unique_t() = default;
+};
+
+inline constexpr sorted_unique_t sorted_unique{};
+
+template<typename T, typename Compare = std::less<T>, typename Allocator = std::allocator<T>>
 struct set {
 private:
     struct node;
 
     struct base_node {
         node *left = nullptr, *right = nullptr;
+    };
 
-        ~base_node() {
-            if (left)
-                delete left;
-            if (right)
-                delete right;
+    // Whether the order is the default one, std::less<T>.
+    static constexpr bool default_order = std::is_same_v<Compare, std::less<T>>;
+
+    // A prefix orders keys as operator< does, so it is of no use with other
+    // orders. A specialization of std::less<T> for a T that has a prefix or
+    // a three-way comparison must order as operator< does.
+    static constexpr bool has_prefix = std::is_invocable_r_v<std::uint64_t, set_key_prefix<T> const&, T const&>
+                                       && (default_order || std::is_same_v<Compare, std::less<>>);
+
+    // The same goes for three-way comparison.
+    static constexpr bool has_three_way = std::is_invocable_r_v<int, set_three_way<T> const&, T const&, T const&>
+                                          && (default_order || std::is_same_v<Compare, std::less<>>);
+
+    // operator< of a key of another type than T with T, or the other way.
+    struct natural_less {
+        template<typename A, typename B>
+        auto operator()(A const& a, B const& b) const -> decltype(a < b) {
+            return a < b;
         }
     };
 
-    struct node: base_node {
+    // Two values of T are always compared by Compare, so that a
+    // specialization of std::less<T> is honoured. std::less<T> can not
+    // compare a key of another type without converting it to T, such a key
+    // is compared by operator< instead.
+    template<typename A, typename B>
+    static bool less(Compare const& comp, A const& a, B const& b) {
+        if constexpr (default_order && !(std::is_same_v<A, T> && std::is_same_v<B, T>))
+            return natural_less()(a, b);
+        else
+            return comp(a, b);
+    }
+
+    struct no_prefix {
+        static constexpr std::uint64_t prefix = 0;
+    };
+
+    struct key_prefix {
+        std::uint64_t prefix;
+    };
+
+    static std::uint64_t prefix_of([[maybe_unused]] T const& value) noexcept {
+        if constexpr (has_prefix)
+            return set_key_prefix<T>()(value);
+        else
+            return 0;
+    }
+
+    struct node: base_node, std::conditional_t<has_prefix, key_prefix, no_prefix> {
         T data;
         base_node *parent;
 
         node() = delete;
-        node(T const& value, base_node* parent): data(value), parent(parent) {};
+
+        template<typename... Args>
+        explicit node(base_node* parent, Args&&... args): data(std::forward<Args>(args)...), parent(parent) {
+            if constexpr (has_prefix)
+                this->prefix = prefix_of(data);
+        }
+    };
+
+    // A value being looked up, with its prefix computed once. A key of
+    // another type is compared with the elements as it is, without a prefix.
+    template<typename K>
+    struct basic_probe {
+        static constexpr bool prefixed = has_prefix && std::is_same_v<K, T>;
+        static constexpr bool three_way = has_three_way && std::is_same_v<K, T>;
+
+        K const& value;
+        Compare const& comp;
+        std::uint64_t prefix = 0;
+
+        basic_probe(K const& value, Compare const& comp) noexcept: value(value), comp(comp) {
+            if constexpr (prefixed)
+                prefix = prefix_of(value);
+        }
+
+        // value < v->data
+        bool before(node const* v) const {
+            if (prefixed && prefix != v->prefix)
+                return prefix < v->prefix;
+            return less(comp, value, v->data);
+        }
+
+        // v->data < value
+        bool after(node const* v) const {
+            if (prefixed && prefix != v->prefix)
+                return v->prefix < prefix;
+            return less(comp, v->data, value);
+        }
+
+        // Negative, zero or positive as value is less than, equivalent to or
+        // greater than v->data, with a single comparison if T has one.
+        int compare(node const* v) const {
+            if (prefixed && prefix != v->prefix)
+                return prefix < v->prefix ? -1 : 1;
+            if constexpr (three_way)
+                return set_three_way<T>()(value, v->data);
+            else
+                return before(v) ? -1 : after(v) ? 1 : 0;
+        }
+    };
+
+    using probe = basic_probe<T>;
+
+    // Converting it to K takes up the one user-defined conversion allowed,
+    // so a comparison with it can not go through a conversion of K to T.
+    template<typename K>
+    struct exact_key {
+        operator K const&() const noexcept;
+    };
+
+    // The order keys of other types than T are compared with T by.
+    using order = std::conditional_t<default_order, natural_less, Compare>;
+
+    template<typename C, typename = void>
+    struct is_transparent: std::false_type {};
+
+    template<typename C>
+    struct is_transparent<C, std::void_t<typename C::is_transparent>>: std::true_type {};
+
+    // Whether K is compared with T by a built-in operator<, which mixes
+    // signedness or precision instead of converting K to T first.
+    template<typename K>
+    static constexpr bool builtin_order = std::is_scalar_v<K> && std::is_scalar_v<T>;
+
+    // Keys of other types than T are looked up as they are if the order
+    // compares them with T both ways without converting them to T. Other
+    // orders than the default one must declare is_transparent for that; the
+    // default one takes only keys that have their own operator< with T, so
+    // that find(3u) in a set<int> still looks up int(3).
+    template<typename K>
+    struct transparent_key: std::bool_constant<!std::is_same_v<K, T>
+                                               && (is_transparent<Compare>::value
+                                                   || (default_order && !builtin_order<K>))
+                                               && std::is_invocable_r_v<bool, order const&, T const&, exact_key<K>>
+                                               && std::is_invocable_r_v<bool, order const&, exact_key<K>, T const&>> {};
+
+    template<typename K>
+    using if_transparent = std::enable_if_t<transparent_key<K>::value>;
+
+    // Nodes are carved out of slabs of contiguous storage. The first slot of
+    // a slab holds its header, erased nodes are kept in a free list for reuse
+    // and slabs go back to the allocator only when the whole tree is freed.
+    struct slab {
+        slab *next;
+        size_t slots;
+    };
+
+    struct free_slot {
+        free_slot *next;
+    };
+
+    static_assert(sizeof(slab) <= sizeof(node) && alignof(slab) <= alignof(node));
+
+    struct node_pool {
+        slab *slabs = nullptr;
+        node *bump = nullptr, *bump_end = nullptr;
+        free_slot *free = nullptr;
+        size_t last_slots = 0;
+    };
+
+    static constexpr size_t first_slab_slots = 8;
+    static constexpr size_t max_slab_slots = 65536 / sizeof(node) > first_slab_slots
+                                             ? 65536 / sizeof(node) : first_slab_slots;
+
+    // Kept in the set itself, so that end() and the parent of the topmost
+    // node stay the same however the contents change. Moving the elements to
+    // another set points the topmost node at the header of that set.
+    //
+    // The smallest and the largest nodes are tracked, so that begin() and
+    // hinted inserts at either end take O(1). Both are the header when the
+    // tree is empty.
+    struct tree {
+        size_t size;
+        base_node root;
+        base_node *leftmost, *rightmost;
+        node_pool pool;
+
+        tree() noexcept: size(0), root(), leftmost(&root), rightmost(&root), pool() {}
+    };
+
+    using alloc_traits = std::allocator_traits<Allocator>;
+    using node_allocator = typename alloc_traits::template rebind_alloc<node>;
+    using node_traits = std::allocator_traits<node_allocator>;
+
+    template<typename A, typename = void>
+    struct has_destroy: std::false_type {};
+
+    template<typename A>
+    struct has_destroy<A, std::void_t<decltype(std::declval<A&>().destroy(std::declval<node*>()))>>: std::true_type {};
+
+    // When destroying a node does nothing, the slabs work as a bump arena:
+    // the whole tree is dropped by freeing them, without visiting nodes.
+    // This is what clear(), the destructor and assignment do for set<int>.
+    static constexpr bool trivial_teardown = std::is_trivially_destructible_v<node>
+            && (!has_destroy<node_allocator>::value || std::is_same_v<node_allocator, std::allocator<node>>);
+
+    // Stateless comparators are derived from to take no space, unless they
+    // are final.
+    template<typename C, bool = std::is_empty_v<C> && !std::is_final_v<C>>
+    struct compare_holder: C {
+        explicit compare_holder(C const& comp): C(comp) {}
+
+        C& get() noexcept {
+            return *this;
+        }
+
+        C const& get() const noexcept {
+            return *this;
+        }
     };
 
-    size_t _size;
-    base_node root;
+    template<typename C>
+    struct compare_holder<C, false> {
+        C comp;
+
+        explicit compare_holder(C const& comp): comp(comp) {}
+
+        C& get() noexcept {
+            return comp;
+        }
+
+        C const& get() const noexcept {
+            return comp;
+        }
+    };
+
+    // Derives from the allocator and the comparator so that stateless ones
+    // take no space.
+    struct holder: node_allocator, compare_holder<Compare> {
+        tree t;
+
+        holder(node_allocator const& alloc, Compare const& comp)
+                noexcept(std::is_nothrow_copy_constructible_v<Compare>)
+            : node_allocator(alloc), compare_holder<Compare>(comp), t() {}
+    };
+
+    holder _tree;
+
+#ifdef SET_MEMORY_REGISTRY
+    static set_memory_registry::entry& registry() noexcept {
+        static set_memory_registry::entry result(typeid(set).name());
+        return result;
+    }
+#endif
+
+    // Keeps the registry up to date, does nothing without it.
+    static void account([[maybe_unused]] std::ptrdiff_t nodes, [[maybe_unused]] std::ptrdiff_t bytes) noexcept {
+#ifdef SET_MEMORY_REGISTRY
+        registry().nodes.fetch_add(size_t(nodes), std::memory_order_relaxed);
+        registry().bytes.fetch_add(size_t(bytes), std::memory_order_relaxed);
+#endif
+    }
+
+    // Tree handed over to set_reclaimer by clear_async().
+    struct detached;
+
+    node_allocator& alloc() noexcept {
+        return _tree;
+    }
+
+    node_allocator const& alloc() const noexcept {
+        return _tree;
+    }
+
+    Compare& comp() noexcept {
+        return _tree.get();
+    }
+
+    Compare const& comp() const noexcept {
+        return _tree.get();
+    }
+
+    base_node const* header() const noexcept {
+        return &_tree.t.root;
+    }
+
+    node* allocate_node(node_pool& pool) {
+        if (pool.free) {
+            node *v = reinterpret_cast<node*>(pool.free);
+            pool.free = pool.free->next;
+            return v;
+        }
+
+        if (pool.bump == pool.bump_end) {
+            size_t slots = pool.last_slots ? std::min(pool.last_slots * 2, max_slab_slots) : first_slab_slots;
+            node *storage = node_traits::allocate(alloc(), slots + 1);
+            account(0, (slots + 1) * sizeof(node));
+            pool.slabs = ::new (static_cast<void*>(storage)) slab{pool.slabs, slots + 1};
+            pool.bump = storage + 1;
+            pool.bump_end = storage + slots + 1;
+            pool.last_slots = slots;
+        }
+
+        return pool.bump++;
+    }
+
+    static void deallocate_node(node_pool& pool, node* v) noexcept {
+        pool.free = ::new (static_cast<void*>(v)) free_slot{pool.free};
+    }
+
+    void release_slabs(node_pool& pool) noexcept {
+        for (slab *s = pool.slabs; s;) {
+            slab *next = s->next;
+            account(0, -std::ptrdiff_t(s->slots * sizeof(node)));
+            node_traits::deallocate(alloc(), reinterpret_cast<node*>(s), s->slots);
+            s = next;
+        }
+        pool = node_pool();
+    }
+
+    template<typename... Args>
+    node* create_node(base_node* parent, Args&&... args) {
+        node_pool &pool = _tree.t.pool;
+        node *v = allocate_node(pool);
+        try {
+            node_traits::construct(alloc(), v, parent, std::forward<Args>(args)...);
+        } catch (...) {
+            deallocate_node(pool, v);
+            throw;
+        }
+        account(1, 0);
+        return v;
+    }
+
+    void destroy_node(node* v) noexcept {
+        node_traits::destroy(alloc(), v);
+        deallocate_node(_tree.t.pool, v);
+        account(-1, 0);
+    }
+
+    // Only runs the destructors, the memory is freed with the slabs. Left
+    // children are rotated up until the top has none, so no stack is needed
+    // however deep the tree is.
+    void destroy_subtree(node* v) noexcept {
+        while (v) {
+            if (node *l = v->left) {
+                v->left = l->right;
+                l->right = v;
+                v = l;
+            } else {
+                node *r = v->right;
+                node_traits::destroy(alloc(), v);
+                v = r;
+            }
+        }
+    }
+
+    // Same walk, but the slots are also returned to the pool. Returns the
+    // number of nodes freed.
+    size_t free_subtree(node* v) noexcept {
+        node_pool &pool = _tree.t.pool;
+        size_t n = 0;
+        while (v) {
+            if (node *l = v->left) {
+                v->left = l->right;
+                l->right = v;
+                v = l;
+            } else {
+                node *r = v->right;
+                if constexpr (!trivial_teardown)
+                    node_traits::destroy(alloc(), v);
+                deallocate_node(pool, v);
+                v = r;
+                ++n;
+            }
+        }
+        account(-std::ptrdiff_t(n), 0);
+        return n;
+    }
+
+    // Unlinks the nodes before `to` from the subtree `top` which holds it and
+    // returns the root of the rest. The subtrees unlinked are strung by the
+    // right links of their ancestors onto `removed`, which must be empty.
+    static node* cut_before(node* to, node* top, node*& removed) noexcept {
+        assert(!removed);
+        node *kept = to;
+        removed = to->left;
+        to->left = nullptr;
+        for (node *x = to; x != top;) {
+            node *p = static_cast<node*>(x->parent);
+            if (p->right == x) {
+                p->right = removed;
+                removed = p;
+            } else {
+                p->left = kept;
+                kept->parent = p;
+                kept = p;
+            }
+            x = p;
+        }
+        return kept;
+    }
+
+    // Unlinks the nodes from `from` on from the subtree `top` which holds it
+    // and returns the root of the rest. The subtrees unlinked are strung by
+    // the left links of their ancestors onto `removed`.
+    static node* cut_from(node* from, node* top, node*& removed) noexcept {
+        node *kept = from->left;
+        from->left = removed;
+        removed = from;
+        for (node *x = from; x != top;) {
+            node *p = static_cast<node*>(x->parent);
+            if (p->left == x) {
+                p->left = removed;
+                removed = p;
+            } else {
+                p->right = kept;
+                if (kept)
+                    kept->parent = p;
+                kept = p;
+            }
+            x = p;
+        }
+        return kept;
+    }
+
+    void destroy_nodes(tree& t) noexcept {
+        if constexpr (!trivial_teardown) {
+            if (t.root.left)
+                destroy_subtree(t.root.left);
+        }
+        account(-std::ptrdiff_t(t.size), 0);
+        release_slabs(t.pool);
+        t.root.left = nullptr;
+        t.leftmost = t.rightmost = &t.root;
+        t.size = 0;
+    }
+
+    // Exchanges the elements with other, which was made with the same
+    // allocator. The headers stay with their sets, so end() of neither
+    // changes.
+    void swap_contents(set& other) noexcept {
+        tree &a = _tree.t, &b = other._tree.t;
+        std::swap(a.size, b.size);
+        std::swap(a.root.left, b.root.left);
+        std::swap(a.leftmost, b.leftmost);
+        std::swap(a.rightmost, b.rightmost);
+        std::swap(a.pool, b.pool);
+        rehome(a, b);
+        rehome(b, a);
+    }
+
+    // Points the links to the header of `from` which t got from it at the
+    // header of t.
+    static void rehome(tree& t, tree const& from) noexcept {
+        if (t.root.left)
+            t.root.left->parent = &t.root;
+        if (t.leftmost == &from.root)
+            t.leftmost = &t.root;
+        if (t.rightmost == &from.root)
+            t.rightmost = &t.root;
+    }
+
+    // Gives up the elements of *this for the ones of r, which was made with
+    // the same allocator.
+    void replace(set&& r) noexcept {
+        swap_contents(r);
+    }
+
+    // Fills an empty set with copies of the nodes of other in O(n), without
+    // comparing elements. The copy has the same shape as other, its nodes
+    // are laid out in pre-order in a single slab.
+    void copy_from(set const& other) {
+        assert(empty());
+        size_t n = other.size();
+        if (n == 0)
+            return;
+
+        tree const &from = other._tree.t;
+        tree &t = _tree.t;
+        node const *s = nullptr;
+        node *d = nullptr, *first = nullptr, *last = nullptr;
+        node *storage = fill_slab(n, [&](node* slot) {
+            base_node *p = &t.root;
+            bool left = true;
+            if (!s) {
+                s = from.root.left;
+            } else if (s->left) {
+                s = s->left;
+                p = d;
+            } else {
+                node const *w = nullptr;
+                while (!s->right || s->right == w) {
+                    w = s;
+                    s = static_cast<node const*>(s->parent);
+                    d = static_cast<node*>(d->parent);
+                }
+                s = s->right;
+                p = d;
+                left = false;
+            }
+
+            node_traits::construct(alloc(), slot, p, static_cast<T const&>(s->data));
+            if (p != &t.root)
+                (left ? d->left : d->right) = slot;
+            if (s == from.leftmost)
+                first = slot;
+            if (s == from.rightmost)
+                last = slot;
+            d = slot;
+        });
+        install_slab(t, storage, n, n, storage + 1, first, last);
+    }
+
+    // Makes the tree of *this hold copies of the elements of other. The
+    // values are assigned to the existing nodes in order, which keeps the
+    // shape of the tree, and only the difference in size is allocated or
+    // freed. Nodes for the extra elements of other are made first in one
+    // slab and hung after the last node as a balanced subtree; after that
+    // nothing throws.
+    void assign_nodes(set const& other) {
+        static_assert(std::is_nothrow_copy_assignable_v<T>);
+        tree &t = _tree.t;
+        size_t n = other.size();
+
+        size_t k = n > t.size ? n - t.size : 0;
+        node *extra = nullptr;
+        if (k) {
+            iterator i = std::prev(other.end(), k);
+            extra = fill_slab(k, [&](node* slot) {
+                node_traits::construct(alloc(), slot, nullptr, *i);
+                ++i;
+            });
+            t.pool.slabs = ::new (static_cast<void*>(extra)) slab{t.pool.slabs, k + 1};
+        }
+
+        iterator from = other.begin();
+        for (iterator i = begin(); i != end() && from != other.end(); ++i, ++from) {
+            node *v = const_cast<node*>(static_cast<node const*>(i.ptr));
+            v->data = *from;
+            if constexpr (has_prefix)
+                v->prefix = prefix_of(v->data);
+        }
+
+        while (t.size > n)
+            erase(std::prev(end()));
+        if (k)
+            attach_run(t, &t.root, link_sorted(extra + 1, k), extra + 1, extra + k, k);
+    }
+
+    // Links the n nodes at `first`, whose values increase, into a balanced
+    // tree and returns its root. Node i (counting from 1) takes the place of i
+    // in the complete tree over 1, 2, 3, ...: its children are i -/+ b / 2,
+    // b being the lowest set bit of i, and a right child past n is replaced
+    // by its nearest left descendant which is not.
+    static node* link_sorted(node* first, size_t n) noexcept {
+        for (size_t i = 1; i <= n; ++i) {
+            node *v = first + (i - 1);
+            size_t half = (i & -i) / 2;
+            v->left = v->right = nullptr;
+            if (!half)
+                continue;
+
+            v->left = first + (i - half - 1);
+            v->left->parent = v;
+
+            size_t r = i + half;
+            while (r > n && (r & -r) > 1)
+                r -= (r & -r) / 2;
+            if (r <= n) {
+                v->right = first + (r - 1);
+                v->right->parent = v;
+            }
+        }
+
+        size_t top = 1;
+        while (top * 2 <= n)
+            top *= 2;
+        return first + (top - 1);
+    }
+
+    // Returns the node of t holding a value equal to `value`, if any. If not,
+    // `p` and `left` tell where a node with it is to be attached.
+    node* locate(tree& t, T const& value, base_node*& p, bool& left) const {
+        p = &t.root;
+        left = true;
+        return descend(probe(value, comp()), t.root.left, p, left);
+    }
+
+    // Searches the subtree of v, `p` and `left` telling where v hangs.
+    static node* descend(probe const& key, node* v, base_node*& p, bool& left) {
+        while (v) {
+            p = v;
+            int c = key.compare(v);
+            if (c < 0) {
+                v = v->left;
+                left = true;
+            } else if (c > 0) {
+                v = v->right;
+                left = false;
+            } else {
+                return v;
+            }
+        }
+        return nullptr;
+    }
+
+    static void attach(tree& t, node* v, base_node* p, bool left) noexcept {
+        v->parent = p;
+        if (left) {
+            p->left = v;
+            if (t.leftmost == p)
+                t.leftmost = v;
+            if (p == &t.root)
+                t.rightmost = v;
+        } else {
+            p->right = v;
+            if (t.rightmost == p)
+                t.rightmost = v;
+        }
+        t.size++;
+    }
+
+    // Same as locate(), but tries the place right before `hint` and right
+    // after it first. Either check costs O(1) when the neighbour of the
+    // hint in that direction is its child or its parent, or is at an end.
+    node* locate_near(tree& t, base_node const* hint, T const& value, base_node*& p, bool& left) {
+        probe key(value, comp());
+        base_node *h = const_cast<base_node*>(hint);
+
+        if (h == &t.root || key.before(static_cast<node*>(h))) {
+            if (h == t.leftmost) {
+                p = h;
+                left = true;
+                return nullptr;
+            }
+
+            base_node *prev = h == &t.root ? t.rightmost : const_cast<base_node*>((--const_iterator(h)).ptr);
+            if (key.after(static_cast<node*>(prev))) {
+                left = prev->right != nullptr;
+                p = left ? h : prev;
+                return nullptr;
+            }
+        } else if (key.after(static_cast<node*>(h))) {
+            base_node *next = h == t.rightmost ? &t.root : const_cast<base_node*>((++const_iterator(h)).ptr);
+            if (next == &t.root || key.before(static_cast<node*>(next))) {
+                left = h->right != nullptr;
+                p = left ? next : h;
+                return nullptr;
+            }
+        } else {
+            return static_cast<node*>(h);
+        }
+
+        // Tries the end of the set in the same direction, then climbs from
+        // the hint to the lowest subtree which holds the place of value and
+        // searches only it. The bounds of a subtree are the closest ancestors
+        // it hangs to the right and to the left of, and the one on the side
+        // of the hint is already known to be right.
+        bool below = h == &t.root || key.before(static_cast<node*>(h));
+        base_node *end = below ? t.leftmost : t.rightmost;
+        if (below ? key.before(static_cast<node*>(end)) : key.after(static_cast<node*>(end))) {
+            p = end;
+            left = below;
+            return nullptr;
+        }
+
+        node *from = static_cast<node*>(h == &t.root ? t.rightmost : h);
+        base_node *c = from;
+        for (base_node *q = from->parent; q != &t.root; c = q, q = static_cast<node*>(q)->parent) {
+            if (below ? q->right != c : q->left != c)
+                continue;
+            if (below ? key.after(static_cast<node*>(q)) : key.before(static_cast<node*>(q)))
+                break;
+            from = static_cast<node*>(q);
+        }
+        p = from->parent;
+        left = p->left == from;
+        return descend(key, from, p, left);
+    }
+
+    template<typename U>
+    auto insert_value(U&& value) {
+        tree &t = _tree.t;
+        base_node *p;
+        bool left;
+        if (node *found = locate(t, value, p, left))
+            return std::make_pair(iterator(found), false);
+
+        node *v = create_node(p, std::forward<U>(value));
+        attach(t, v, p, left);
+        return std::make_pair(iterator(v), true);
+    }
+
+    template<typename U>
+    auto insert_near(base_node const* hint, U&& value) {
+        tree &t = _tree.t;
+        base_node *p;
+        bool left;
+        if (node *found = locate_near(t, hint, value, p, left))
+            return iterator(found);
+
+        node *v = create_node(p, std::forward<U>(value));
+        attach(t, v, p, left);
+        return iterator(v);
+    }
+
+    // Allocates a slab for n nodes and constructs them in order with
+    // make(slot). Either all n are constructed or nothing is left behind.
+    template<typename Make>
+    node* fill_slab(size_t n, Make make) {
+        size_t made;
+        return fill_slab(n, made, [&](node* slot) {
+            make(slot);
+            return true;
+        });
+    }
+
+    // Same, but make(slot) returns false to stop before the slab is full.
+    // The number of nodes made is stored to `made`; if it is 0, the slab is
+    // freed and nullptr returned.
+    template<typename Make>
+    node* fill_slab(size_t n, size_t& made, Make make) {
+        node *storage = node_traits::allocate(alloc(), n + 1);
+        node *slot = storage + 1;
+        try {
+            while (slot != storage + n + 1 && make(slot))
+                ++slot;
+        } catch (...) {
+            for (node *v = storage + 1; v != slot; ++v)
+                node_traits::destroy(alloc(), v);
+            node_traits::deallocate(alloc(), storage, n + 1);
+            throw;
+        }
+        made = slot - storage - 1;
+        if (made == 0) {
+            node_traits::deallocate(alloc(), storage, n + 1);
+            return nullptr;
+        }
+        account(made, (n + 1) * sizeof(node));
+        return storage;
+    }
+
+    // Makes the slab filled by fill_slab() the only one of the empty tree t,
+    // `top` being the root of the n nodes linked in it. The slots of the
+    // slab past them are left for later inserts.
+    static void install_slab(tree& t, node* storage, size_t slots, size_t n,
+                             node* top, node* first, node* last) noexcept {
+        assert(t.size == 0 && !t.pool.slabs);
+        t.pool.slabs = ::new (static_cast<void*>(storage)) slab{nullptr, slots + 1};
+        t.pool.bump = storage + n + 1;
+        t.pool.bump_end = storage + slots + 1;
+        t.pool.last_slots = slots;
+        t.root.left = top;
+        top->parent = &t.root;
+        t.leftmost = first;
+        t.rightmost = last;
+        t.size = n;
+    }
+
+    // Same for a slab filled in increasing order, its nodes are linked into a
+    // balanced tree.
+    static void install_sorted_slab(tree& t, node* storage, size_t slots, size_t n) noexcept {
+        install_slab(t, storage, slots, n, link_sorted(storage + 1, n), storage + 1, storage + n);
+    }
+
+    // Hangs the balanced subtree `top` over the n nodes first..last into the
+    // empty place right before `at` in t, where all of them belong.
+    static void attach_run(tree& t, base_node* at, node* top, node* first, node* last, size_t n) noexcept {
+        base_node *p = at;
+        bool left = true;
+        if (at == &t.root ? t.root.left != nullptr : at->left != nullptr) {
+            p = at == &t.root ? t.rightmost : at->left;
+            while (p->right)
+                p = p->right;
+            left = false;
+        }
+
+        if (left)
+            p->left = top;
+        else
+            p->right = top;
+        top->parent = p;
+        if (t.leftmost == at)
+            t.leftmost = first;
+        if (at == &t.root)
+            t.rightmost = last;
+        t.size += n;
+    }
+
+    template<typename It>
+    static constexpr bool is_forward = std::is_base_of_v<std::forward_iterator_tag,
+                                                         typename std::iterator_traits<It>::iterator_category>;
+
+    // Fills an empty set with the n increasing values starting at first in
+    // O(n), with one allocation for all the nodes.
+    template<typename It>
+    void build_sorted(It first, size_t n) {
+        clear();
+        if (n == 0)
+            return;
+
+        tree &t = _tree.t;
+        node *storage = fill_slab(n, [&](node* slot) {
+            node_traits::construct(alloc(), slot, nullptr, *first);
+            ++first;
+        });
+        install_sorted_slab(t, storage, n, n);
+    }
+
+    // Searches shared by the lookups with T and with other keys.
+    template<typename Probe>
+    base_node const* find_key(Probe const& key) const {
+        node const *v = header()->left;
+
+        while (v) {
+            int c = key.compare(v);
+            if (c < 0) {
+                v = v->left;
+            } else if (c > 0) {
+                v = v->right;
+            } else {
+                return v;
+            }
+        }
+
+        return header();
+    }
+
+    static void prefetch(void const* p) noexcept {
+#if defined(__GNUC__) || defined(__clang__)
+        __builtin_prefetch(p);
+#else
+        (void)p;
+#endif
+    }
+
+    static constexpr size_t lookup_lanes = 16;
+
+    // Runs the searches for keys[0..n) in lockstep, one level of the tree per
+    // round, and prefetches the next node of each, so that their cache misses
+    // overlap instead of following one another. found[i] is set to the lower
+    // bound of keys[i] and equal[i] to whether it is equivalent to it.
+    template<typename Probe>
+    void lower_bound_batch(std::optional<Probe> const* keys, size_t n, base_node const** found, bool* equal) const {
+        base_node const *h = header();
+        node const *v[lookup_lanes];
+        size_t lane[lookup_lanes];
+        for (size_t i = 0; i != n; ++i) {
+            v[i] = h->left;
+            lane[i] = i;
+            found[i] = h;
+            equal[i] = false;
+        }
+
+        // The first `active` entries of lane are the searches still going.
+        for (size_t active = h->left ? n : 0; active != 0;) {
+            for (size_t j = 0; j != active;) {
+                size_t i = lane[j];
+                node const *w = v[i];
+                int c = keys[i]->compare(w);
+                if (c > 0) {
+                    w = w->right;
+                } else {
+                    found[i] = w;
+                    equal[i] = c == 0;
+                    w = c == 0 ? nullptr : w->left;
+                }
+                v[i] = w;
+                if (w) {
+                    prefetch(w);
+                    ++j;
+                } else {
+                    lane[j] = lane[--active];
+                }
+            }
+        }
+    }
+
+    // Calls emit(i, lower_bound, equal) for the keys of [first, last) in
+    // order, i counting from 0, a batch of lookup_lanes searches at a time.
+    template<typename It, typename Emit>
+    void lower_bound_batches(It first, It last, Emit emit) const {
+        using K = std::remove_cv_t<typename std::iterator_traits<It>::value_type>;
+        static_assert(is_forward<It>, "the keys are referred to while they are searched for");
+        static_assert(std::is_same_v<K, T> || transparent_key<K>::value,
+                      "keys must be of type T or compared with T by the order");
+
+        std::optional<basic_probe<K>> keys[lookup_lanes];
+        base_node const *found[lookup_lanes];
+        bool equal[lookup_lanes];
+        for (size_t done = 0; first != last;) {
+            size_t n = 0;
+            for (; n != lookup_lanes && first != last; ++n, ++first)
+                keys[n].emplace(*first, comp());
+            lower_bound_batch(keys, n, found, equal);
+            for (size_t i = 0; i != n; ++i)
+                emit(done + i, found[i], equal[i]);
+            done += n;
+        }
+    }
+
+    template<typename Probe>
+    base_node const* lower_bound_key(Probe const& key) const {
+        node const *v = header()->left;
+
+        while (v) {
+            int c = key.compare(v);
+            if (c < 0) {
+                if (!v->left) {
+                    return v;
+                }
+                v = v->left;
+            } else if (c > 0) {
+                if (!v->right) {
+                    return (++const_iterator(v)).ptr;
+                }
+                v = v->right;
+            } else {
+                return v;
+            }
+        }
+
+        return header();
+    }
+
+    template<typename Probe>
+    base_node const* upper_bound_key(Probe const& key) const {
+        node const *v = header()->left;
+
+        while (v) {
+            if (key.before(v)) {
+                if (!v->left) {
+                    return v;
+                }
+                v = v->left;
+            } else {
+                if (!v->right) {
+                    return (++const_iterator(v)).ptr;
+                }
+                v = v->right;
+            }
+        }
+
+        return header();
+    }
+
+    template<typename K>
+    size_t erase_key(K const& key) {
+        const_iterator it = find(key);
+        if (it == end())
+            return 0;
+        erase(it);
+        return 1;
+    }
+
+    // First element not less than key, searched for upwards from `from`, an
+    // element less than key, or from the root if `from` is null. The climb
+    // stops at the lowest subtree that holds the place of key, so on a
+    // balanced tree the search takes O(log d) steps, d being the distance
+    // from `from` to the result. `equal` tells if the result is equivalent
+    // to key.
+    template<typename Probe>
+    base_node const* lower_bound_from(base_node const* from, Probe const& key, bool& equal) const {
+        base_node const *h = header(), *result = h;
+        node const *v = h->left;
+        equal = false;
+
+        if (from) {
+            node const *u = static_cast<node const*>(from);
+            for (;;) {
+                node const *w = u;
+                while (w->parent != h && w->parent->right == w)
+                    w = static_cast<node const*>(w->parent);
+                if (w->parent == h)
+                    break;
+                int c = key.compare(static_cast<node const*>(w->parent));
+                if (c <= 0) {
+                    result = w->parent;
+                    equal = c == 0;
+                    if (equal)
+                        return result;
+                    break;
+                }
+                u = static_cast<node const*>(w->parent);
+            }
+            v = u->right;
+        }
+
+        while (v) {
+            int c = key.compare(v);
+            if (c > 0) {
+                v = v->right;
+            } else {
+                result = v;
+                if (c == 0) {
+                    equal = true;
+                    break;
+                }
+                v = v->left;
+            }
+        }
+
+        return result;
+    }
+
+    // Looks up the lower bounds of increasing values in owner, each search
+    // starting from the previous result. The caller may move `last` forward
+    // to any element up to the next result, e.g. past an erased one.
+    struct finger {
+        set const &owner;
+        base_node const *last = nullptr;
+        bool equal = false;
+
+        base_node const* lower_bound(T const& value) {
+            equal = false;
+            if (last == owner.header())
+                return last;
+
+            probe key(value, owner.comp());
+            if (last) {
+                int c = key.compare(static_cast<node const*>(last));
+                if (c <= 0) {
+                    equal = c == 0;
+                    return last;
+                }
+            }
+            return last = owner.lower_bound_from(last, key, equal);
+        }
+    };
+
+    // Negative, zero or positive as *i is less than, equivalent to or
+    // greater than *j, with the order of *this; i and j are iterators.
+    template<typename It>
+    int compare(It i, It j) const {
+        return probe(*i, comp()).compare(static_cast<node const*>(j.ptr));
+    }
+
+    // Makes a set with the order and the allocator of a out of copies of the
+    // values next() points to, in increasing order, until it returns
+    // nullptr. At most `slots` values are taken; they are linked into a
+    // balanced tree in one slab, the rest of which is left for inserts.
+    template<typename Next>
+    static set build_from(set const& a, size_t slots, Next next) {
+        set result(a.comp(), a.get_allocator());
+        if (slots == 0)
+            return result;
+
+        tree &t = result._tree.t;
+        size_t n;
+        node *storage = result.fill_slab(slots, n, [&](node* slot) {
+            T const *x = next();
+            if (x)
+                node_traits::construct(result.alloc(), slot, nullptr, *x);
+            return x != nullptr;
+        });
+        if (storage)
+            install_sorted_slab(t, storage, slots, n);
+        return result;
+    }
 public:
     struct iterator: public std::iterator<std::bidirectional_iterator_tag, T const> {
         iterator() noexcept: ptr(nullptr) {}
@@ -61,79 +1274,261 @@ public:
             }
 
             return *this;
-        }
+        }
+
+        iterator operator--() {
+            if (ptr->left) {
+                ptr = ptr->left;
+                while (ptr->right)
+                    ptr = ptr->right;
+            } else {
+                base_node const *w = ptr;
+                ptr = static_cast<node const*>(ptr)->parent;
+                while (ptr && ptr->left == w) {
+                    w = ptr;
+                    ptr = static_cast<node const*>(ptr)->parent;
+                }
+            }
+
+            return *this;
+        }
+
+        iterator const operator++(int) {
+            iterator other = *this;
+            ++*this;
+            return other;
+        }
+
+        iterator const operator--(int) {
+            iterator other = *this;
+            --*this;
+            return other;
+        }
+
+        friend bool operator==(iterator const& a, iterator const& b) noexcept {
+            return a.ptr == b.ptr;
+        }
+
+        friend bool operator!=(iterator const& a, iterator const& b) noexcept {
+            return a.ptr != b.ptr;
+        }
+    private:
+        base_node const *ptr;
+
+        friend class set;
+    };
+
+    using const_iterator = iterator;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = reverse_iterator;
+
+    using allocator_type = Allocator;
+
+    // Owns an element taken out of a set by extract() until it is inserted
+    // again. Nodes live in the slabs of their tree and can not outlive it,
+    // so unlike the node handle of std::set this one keeps the element
+    // itself, not its node:
+    // - extract() and inserting the handle each move the element, pointers
+    //   and references to it do not carry over to the set it goes to;
+    // - the element takes a free slot of that set, or a new slab is
+    //   allocated if it has none, so inserting a handle may allocate and
+    //   throw std::bad_alloc;
+    // - T is moved, never copied, unless its move constructor can throw.
+    struct node_type {
+        using value_type = T;
+        using allocator_type = Allocator;
+
+        node_type() noexcept = default;
+
+        node_type(node_type&& other) noexcept(std::is_nothrow_move_constructible_v<T>)
+            : element(std::move(other.element)), allocator(std::move(other.allocator)) {
+            other.element.reset();
+            other.allocator.reset();
+        }
+
+        // T need not be assignable, the element is destroyed and constructed
+        // anew.
+        node_type& operator=(node_type&& other) noexcept(std::is_nothrow_move_constructible_v<T>) {
+            if (this == &other)
+                return *this;
+            element.reset();
+            allocator.reset();
+            if (other.element) {
+                element.emplace(std::move(*other.element));
+                allocator.emplace(std::move(*other.allocator));
+                other.element.reset();
+                other.allocator.reset();
+            }
+            return *this;
+        }
+
+        bool empty() const noexcept {
+            return !element;
+        }
+
+        explicit operator bool() const noexcept {
+            return bool(element);
+        }
+
+        T& value() noexcept {
+            return *element;
+        }
+
+        T const& value() const noexcept {
+            return *element;
+        }
+
+        allocator_type get_allocator() const {
+            return *allocator;
+        }
+    private:
+        std::optional<T> element;
+        std::optional<Allocator> allocator;
+
+        friend struct set;
+    };
+
+    struct insert_return_type {
+        iterator position;
+        bool inserted;
+        node_type node;
+    };
+
+    set() noexcept(noexcept(Allocator()) && noexcept(Compare())): set(Compare()) {
+    }
+
+    explicit set(Compare const& comp, Allocator const& alloc = Allocator())
+            noexcept(std::is_nothrow_copy_constructible_v<Compare>)
+        : _tree(node_allocator(alloc), comp) {
+#ifdef SET_MEMORY_REGISTRY
+        registry().sets.fetch_add(1, std::memory_order_relaxed);
+#endif
+    }
+
+    explicit set(Allocator const& alloc): set(Compare(), alloc) {
+    }
+
+    // Builds the tree in O(n) if the range is sorted and has no duplicates,
+    // which takes a single pass to check for a forward range.
+    template<typename InputIt, typename = typename std::iterator_traits<InputIt>::iterator_category>
+    set(InputIt first, InputIt last, Compare const& comp = Compare(), Allocator const& alloc = Allocator())
+        : set(comp, alloc) {
+        insert(first, last);
+    }
+
+    template<typename InputIt, typename = typename std::iterator_traits<InputIt>::iterator_category>
+    set(InputIt first, InputIt last, Allocator const& alloc): set(first, last, Compare(), alloc) {
+    }
+
+    // The range must be sorted and free of duplicates, which is not checked.
+    template<typename InputIt, typename = typename std::iterator_traits<InputIt>::iterator_category>
+    set(sorted_unique_t, InputIt first, InputIt last, Compare const& comp = Compare(),
+        Allocator const& alloc = Allocator())
+        : set(comp, alloc) {
+        insert(sorted_unique, first, last);
+    }
+
+    template<typename InputIt, typename = typename std::iterator_traits<InputIt>::iterator_category>
+    set(sorted_unique_t, InputIt first, InputIt last, Allocator const& alloc)
+        : set(sorted_unique, first, last, Compare(), alloc) {
+    }
+
+    set(const set& other): set(other, alloc_traits::select_on_container_copy_construction(other.get_allocator())) {
+    }
+
+    set(const set& other, Allocator const& alloc): set(other.comp(), alloc) {
+        copy_from(other);
+    }
+
+    // Takes the elements over in O(1), other is left empty. Iterators of
+    // other but end() stay valid and now refer to *this.
+    set(set&& other) noexcept(std::is_nothrow_copy_constructible_v<Compare>): set(other.comp(), other.get_allocator()) {
+        swap_contents(other);
+    }
+
+    set(set&& other, Allocator const& alloc): set(other.comp(), alloc) {
+        if (this->alloc() == other.alloc()) {
+            swap_contents(other);
+        } else {
+            copy_from(other);
+            other.clear();
+        }
+    }
+
+    // The elements are copied into the nodes *this already has if assigning
+    // T can not throw and other is at most twice as large; appended nodes
+    // hang below the last one, so larger sets are copied afresh.
+    set& operator=(set const& other) {
+        if (this == &other)
+            return *this;
 
-        iterator operator--() {
-            if (ptr->left) {
-                ptr = ptr->left;
-                while (ptr->right)
-                    ptr = ptr->right;
-            } else {
-                base_node const *w = ptr;
-                ptr = static_cast<node const*>(ptr)->parent;
-                while (ptr && ptr->left == w) {
-                    w = ptr;
-                    ptr = static_cast<node const*>(ptr)->parent;
-                }
+        constexpr bool propagate = alloc_traits::propagate_on_container_copy_assignment::value;
+        if constexpr (std::is_nothrow_copy_assignable_v<T>) {
+            if ((!propagate || alloc() == other.alloc()) && !empty() && other.size() / 2 <= size()) {
+                assign_nodes(other);
+                comp() = other.comp();
+                if constexpr (propagate)
+                    alloc() = other.alloc();
+                return *this;
             }
-
-            return *this;
         }
 
-        iterator const operator++(int) {
-            iterator other = *this;
-            ++*this;
-            return other;
-        }
+        set copy(other, propagate ? other.get_allocator() : get_allocator());
 
-        iterator const operator--(int) {
-            iterator other = *this;
-            --*this;
-            return other;
-        }
+        comp() = other.comp();
+        clear();
+        if constexpr (propagate)
+            alloc() = other.alloc();
+        swap_contents(copy);
+        return *this;
+    }
 
-        friend bool operator==(iterator const& a, iterator const& b) noexcept {
-            return a.ptr == b.ptr;
-        }
+    // O(1) unless the allocators differ and do not propagate: then the
+    // elements are copied and other is cleared.
+    set& operator=(set&& other) noexcept(alloc_traits::propagate_on_container_move_assignment::value
+                                         || alloc_traits::is_always_equal::value) {
+        if (this == &other)
+            return *this;
 
-        friend bool operator!=(iterator const& a, iterator const& b) noexcept {
-            return a.ptr != b.ptr;
+        constexpr bool propagate = alloc_traits::propagate_on_container_move_assignment::value;
+        if (!propagate && alloc() != other.alloc()) {
+            set copy(other, get_allocator());
+            comp() = other.comp();
+            clear();
+            swap_contents(copy);
+            other.clear();
+            return *this;
         }
-    private:
-        base_node const *ptr;
-
-        friend class set;
-    };
 
-    using const_iterator = iterator;
-    using reverse_iterator = std::reverse_iterator<iterator>;
-    using const_reverse_iterator = reverse_iterator;
+        comp() = other.comp();
+        clear();
+        if constexpr (propagate)
+            alloc() = std::move(other.alloc());
+        swap_contents(other);
+        return *this;
+    }
 
-    set() noexcept: _size(0), root() {
+    ~set() {
+        clear();
+#ifdef SET_MEMORY_REGISTRY
+        registry().sets.fetch_sub(1, std::memory_order_relaxed);
+#endif
     }
 
-    set(const set& other): set() {
-        try {
-            for (auto &e: other)
-                insert(e);
-        } catch (...) {
-            clear();
-            throw;
-        }
+    allocator_type get_allocator() const noexcept {
+        return allocator_type(alloc());
     }
 
-    set& operator=(set other) noexcept {
-        swap(*this, other);
-        return *this;
+    Compare key_comp() const {
+        return comp();
     }
 
-    ~set() = default;
+    Compare value_comp() const {
+        return comp();
+    }
 
     const_iterator begin() const noexcept {
-        base_node const *ptr = &root;
-        while (ptr->left)
-            ptr = ptr->left;
-        return ptr;
+        return _tree.t.leftmost;
     }
 
     const_iterator cbegin() const noexcept {
@@ -141,7 +1536,7 @@ public:
     }
 
     const_iterator end() const noexcept {
-        return &root;
+        return header();
     }
 
     const_iterator cend() const noexcept {
@@ -162,91 +1557,233 @@ public:
     }
 
     std::pair<iterator, bool> insert(T const& value) {
-        node *v = root.left;
-        base_node *p = &root;
+        return insert_value(value);
+    }
 
-        while (v) {
-            p = v;
-            if (value < v->data) {
-                v = v->left;
-            } else if (v->data < value) {
-                v = v->right;
-            } else {
-                return std::make_pair(iterator(v), false);
-            }
-        }
+    std::pair<iterator, bool> insert(T&& value) {
+        return insert_value(std::move(value));
+    }
 
-        _size++;
-        if (p == &root || value < static_cast<node*>(p)->data) {
-            v = p->left = new node(value, p);
-        } else {
-            v = p->right = new node(value, p);
+    // Constructs the value right in a node.
+    template<typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args) {
+        tree &t = _tree.t;
+        node *v = create_node(nullptr, std::forward<Args>(args)...);
+        base_node *p;
+        bool left;
+        node *found;
+        try {
+            found = locate(t, v->data, p, left);
+        } catch (...) {
+            destroy_node(v);
+            throw;
         }
+        if (found) {
+            destroy_node(v);
+            return std::make_pair(iterator(found), false);
+        }
+        attach(t, v, p, left);
         return std::make_pair(iterator(v), true);
     }
 
-    const_iterator find(T const& value) const {
-        node *v = root.left;
-
-        while (v) {
-            if (value < v->data) {
-                v = v->left;
-            } else if (v->data < value) {
-                v = v->right;
-            } else {
-                return v;
+    // Into an empty set, a sorted forward range of T without duplicates is
+    // built in O(n) in one allocation. Otherwise the values are inserted one
+    // by one with end() as the hint, so increasing runs are still cheap.
+    template<typename InputIt, typename = typename std::iterator_traits<InputIt>::iterator_category>
+    void insert(InputIt first, InputIt last) {
+        using value_type = typename std::iterator_traits<InputIt>::value_type;
+        if constexpr (is_forward<InputIt> && std::is_same_v<std::remove_cv_t<value_type>, T>) {
+            if (empty() && std::adjacent_find(first, last, [this](T const& a, T const& b) { return !less(comp(), a, b); }) == last) {
+                build_sorted(first, std::distance(first, last));
+                return;
             }
         }
 
-        return &root;
+        for (; first != last; ++first)
+            insert(end(), *first);
     }
 
-    const_iterator lower_bound(T const& value) const noexcept {
-        node *v = root.left;
+    // Inserts the values of [first, last), in any order and with repeats,
+    // and returns how many were new. The values are copied to a buffer,
+    // sorted and deduplicated before the place of each in the tree is
+    // searched for. The new values are then moved into nodes in one slab,
+    // and every run of them that goes into the same place is hung there as
+    // a balanced subtree. If an exception is thrown, there are no effects.
+    template<typename InputIt, typename = typename std::iterator_traits<InputIt>::iterator_category>
+    size_t insert_many(InputIt first, InputIt last) {
+        std::vector<T> batch(first, last);
+        auto before = [this](T const& a, T const& b) { return less(comp(), a, b); };
+        std::sort(batch.begin(), batch.end(), before);
+        batch.erase(std::unique(batch.begin(), batch.end(), [&](T const& a, T const& b) { return !before(a, b); }),
+                    batch.end());
+        if (empty()) {
+            build_sorted(std::make_move_iterator(batch.begin()), batch.size());
+            return batch.size();
+        }
 
-        while (v) {
-            if (value < v->data) {
-                if (!v->left) {
-                    return v;
-                }
-                v = v->left;
-            } else if (v->data < value) {
-                if (!v->right) {
-                    const_iterator result(v);
-                    return ++result;
-                }
-                v = v->right;
-            } else {
-                return v;
+        // The element each value goes right before, null if *this has it.
+        // Values far apart are searched for in lockstep from the root, dense
+        // ones each from the place of the previous one.
+        std::vector<base_node const*> at(batch.size());
+        auto locate_all = [&] {
+            size_t n = 0;
+            if (batch.size() < size() / 8) {
+                lower_bound_batches(batch.begin(), batch.end(), [&](size_t i, base_node const* r, bool equal) {
+                    at[i] = equal ? nullptr : r;
+                    n += !equal;
+                });
+                return n;
+            }
+
+            finger f{*this};
+            for (size_t i = 0; i != batch.size(); ++i) {
+                base_node const *r = f.lower_bound(batch[i]);
+                at[i] = f.equal ? nullptr : r;
+                n += !f.equal;
+            }
+            return n;
+        };
+        size_t n = locate_all();
+        if (n == 0)
+            return 0;
+
+        tree &t = _tree.t;
+        size_t i = 0;
+        node *storage = fill_slab(n, [&](node* slot) {
+            while (!at[i])
+                ++i;
+            node_traits::construct(alloc(), slot, nullptr, std::move(batch[i++]));
+        });
+        t.pool.slabs = ::new (static_cast<void*>(storage)) slab{t.pool.slabs, n + 1};
+
+        // The values that go before the same element are next to each other.
+        node *v = storage + 1;
+        for (size_t j = 0; j != batch.size();) {
+            if (!at[j]) {
+                ++j;
+                continue;
+            }
+            size_t k = j + 1;
+            while (k != batch.size() && at[k] == at[j])
+                ++k;
+            attach_run(t, const_cast<base_node*>(at[j]), link_sorted(v, k - j), v, v + (k - j - 1), k - j);
+            v += k - j;
+            j = k;
+        }
+        return n;
+    }
+
+    // Same as above, the range must be sorted and have no duplicates.
+    template<typename InputIt, typename = typename std::iterator_traits<InputIt>::iterator_category>
+    void insert(sorted_unique_t, InputIt first, InputIt last) {
+        if constexpr (is_forward<InputIt>) {
+            if (empty()) {
+                build_sorted(first, std::distance(first, last));
+                return;
             }
         }
 
-        return &root;
+        for (; first != last; ++first)
+            insert(end(), *first);
     }
 
-    const_iterator upper_bound(T const& value) const {
-        node *v = root.left;
+    // Inserts value as close as possible to the position right before hint:
+    // amortized O(1) if it belongs there or right after hint, a normal
+    // search otherwise.
+    iterator insert(const_iterator hint, T const& value) {
+        return insert_near(hint.ptr, value);
+    }
 
-        while (v) {
-            if (value < v->data) {
-                if (!v->left) {
-                    return v;
-                }
-                v = v->left;
-            } else {
-                if (!v->right) {
-                    const_iterator result(v);
-                    return ++result;
-                }
-                v = v->right;
-            }
+    iterator insert(const_iterator hint, T&& value) {
+        return insert_near(hint.ptr, std::move(value));
+    }
+
+    template<typename... Args>
+    iterator emplace_hint(const_iterator hint, Args&&... args) {
+        tree &t = _tree.t;
+        node *v = create_node(nullptr, std::forward<Args>(args)...);
+        base_node *p;
+        bool left;
+        node *found;
+        try {
+            found = locate_near(t, hint.ptr, v->data, p, left);
+        } catch (...) {
+            destroy_node(v);
+            throw;
+        }
+        if (found) {
+            destroy_node(v);
+            return found;
         }
+        attach(t, v, p, left);
+        return v;
+    }
+
+    const_iterator find(T const& value) const {
+        return find_key(probe(value, comp()));
+    }
+
+    template<typename K, typename = if_transparent<K>>
+    const_iterator find(K const& key) const {
+        return find_key(basic_probe<K>(key, comp()));
+    }
+
+    const_iterator lower_bound(T const& value) const {
+        return lower_bound_key(probe(value, comp()));
+    }
+
+    template<typename K, typename = if_transparent<K>>
+    const_iterator lower_bound(K const& key) const {
+        return lower_bound_key(basic_probe<K>(key, comp()));
+    }
+
+    const_iterator upper_bound(T const& value) const {
+        return upper_bound_key(probe(value, comp()));
+    }
+
+    template<typename K, typename = if_transparent<K>>
+    const_iterator upper_bound(K const& key) const {
+        return upper_bound_key(basic_probe<K>(key, comp()));
+    }
+
+    size_t count(T const& value) const {
+        return find(value) != end();
+    }
+
+    template<typename K, typename = if_transparent<K>>
+    size_t count(K const& key) const {
+        return find(key) != end();
+    }
+
+    // Writes to out what find() returns for each key of [first, last), in
+    // order. The keys, of type T or looked up transparently, are searched
+    // for in batches whose searches advance together with the next node of
+    // each prefetched, which hides most of the latency of a large tree.
+    template<typename It, typename Out>
+    Out find_many(It first, It last, Out out) const {
+        base_node const *h = header();
+        lower_bound_batches(first, last, [&](size_t, base_node const* found, bool equal) {
+            *out = const_iterator(equal ? found : h);
+            ++out;
+        });
+        return out;
+    }
 
-        return &root;
+    // Same, but only sets bit i % 64 of bitmap[i / 64] when the i-th key is
+    // in the set and clears it otherwise. The bits past the last key in
+    // its word are cleared too.
+    template<typename It>
+    void contains_many(It first, It last, std::uint64_t* bitmap) const {
+        lower_bound_batches(first, last, [&](size_t i, base_node const*, bool equal) {
+            std::uint64_t &word = bitmap[i / 64];
+            if (i % 64 == 0)
+                word = 0;
+            word |= std::uint64_t(equal) << i % 64;
+        });
     }
 
     iterator erase(const_iterator it) {
-        --_size;
+        --_tree.t.size;
 
         iterator result = it;
         ++result;
@@ -254,26 +1791,33 @@ public:
         node *v = const_cast<node*>(static_cast<node const*>(it.ptr));
         base_node *p = v->parent;
 
+        tree &t = _tree.t;
+        if (t.leftmost == v)
+            t.leftmost = const_cast<base_node*>(result.ptr);
+        if (t.rightmost == v) {
+            base_node *prev = p;
+            if (v->left)
+                for (prev = v->left; prev->right;)
+                    prev = prev->right;
+            t.rightmost = prev;
+        }
+
         if (!v->left) {
             if (p->left == v)
                 p->left = v->right;
             else
                 p->right = v->right;
 
-            if (v->right) {
+            if (v->right)
                 v->right->parent = p;
-                v->right = nullptr;
-            }
         } else if (!v->right) {
             if (p->left == v)
                 p->left = v->left;
             else
                 p->right = v->left;
 
-            if (v->left) {
+            if (v->left)
                 v->left->parent = p;
-                v->left = nullptr;
-            }
         } else {
             node *next = const_cast<node*>(static_cast<node const*>(result.ptr));
             assert(next->left == nullptr);
@@ -308,40 +1852,516 @@ public:
                 else
                     p->right = next;
             }
+        }
+
+        destroy_node(v);
+
+        return result;
+    }
+
+    // Removes the elements in [first, last). Only the paths from first and
+    // last up to their lowest common ancestor are rewired, the subtrees
+    // hanging off them are unlinked whole, so this costs O(height) plus the
+    // k destructors, and the nodes go back to the pool together at the end.
+    iterator erase(const_iterator first, const_iterator last) {
+        if (first == last)
+            return last;
+        if (first == begin() && last == end()) {
+            clear();
+            return end();
+        }
+
+        tree &t = _tree.t;
+        base_node *h = &t.root;
+        node *a = const_cast<node*>(static_cast<node const*>(first.ptr));
+        base_node *b = const_cast<base_node*>(last.ptr);
+        base_node *prev = a == t.leftmost ? h : const_cast<base_node*>((--const_iterator(a)).ptr);
+
+        // The lowest common ancestor of a and b, the header being above the
+        // root.
+        base_node *c = b;
+        if (b != h) {
+            auto depth = [h](base_node* v) {
+                size_t d = 0;
+                for (; v != h; v = static_cast<node*>(v)->parent)
+                    ++d;
+                return d;
+            };
+            auto up = [](base_node* v) {
+                return static_cast<node*>(v)->parent;
+            };
+            base_node *x = a;
+            size_t dx = depth(x), dy = depth(b);
+            for (c = b; dx > dy; --dx)
+                x = up(x);
+            for (; dy > dx; --dy)
+                c = up(c);
+            while (x != c) {
+                x = up(x);
+                c = up(c);
+            }
+        }
+
+        node *removed = nullptr;
+        if (c == b) {
+            // a is in the left subtree of b.
+            node *rest = cut_from(a, b->left, removed);
+            b->left = rest;
+            if (rest)
+                rest->parent = b;
+        } else {
+            // c is in the range and b, the first element of its right
+            // subtree once the range is cut out of it, takes its place.
+            node *v = static_cast<node*>(c), *w = static_cast<node*>(b);
+            node *right = cut_before(w, v->right, removed);
+            node *left = v == a ? a->left : cut_from(a, v->left, removed);
+            if (right == w) {
+                right = w->right;
+            } else {
+                w->parent->left = w->right;
+                if (w->right)
+                    w->right->parent = w->parent;
+            }
+
+            w->left = left;
+            if (left)
+                left->parent = w;
+            w->right = right;
+            if (right)
+                right->parent = w;
+            base_node *p = v->parent;
+            if (p->left == v)
+                p->left = w;
+            else
+                p->right = w;
+            w->parent = p;
 
-            v->left = nullptr;
+            v->left = removed;
             v->right = nullptr;
+            removed = v;
         }
 
-        delete v;
+        t.size -= free_subtree(removed);
+        if (t.leftmost == a)
+            t.leftmost = b;
+        if (b == h)
+            t.rightmost = prev;
+        return last;
+    }
+
+    size_t erase(T const& value) {
+        return erase_key(value);
+    }
+
+    template<typename K, typename = if_transparent<K>>
+    size_t erase(K const& key) {
+        return erase_key(key);
+    }
+
+    // Removes the element at `it` and hands it over to the returned handle.
+    node_type extract(const_iterator it) {
+        node_type result;
+        result.element.emplace(std::move_if_noexcept(const_cast<T&>(*it)));
+        result.allocator.emplace(get_allocator());
+        erase(it);
+        return result;
+    }
+
+    node_type extract(T const& value) {
+        const_iterator it = find(value);
+        return it == end() ? node_type() : extract(it);
+    }
 
+    // Inserts the element of `nh`, if *this has no equal one. Otherwise the
+    // element stays in the returned node. The allocator of `nh` must compare
+    // equal to the one of *this.
+    insert_return_type insert(node_type&& nh) {
+        if (nh.empty())
+            return {end(), false, node_type()};
+        assert(nh.get_allocator() == get_allocator());
+
+        std::pair<iterator, bool> r = insert(std::move_if_noexcept(*nh.element));
+        if (!r.second)
+            return {r.first, false, std::move(nh)};
+        nh = node_type();
+        return {r.first, true, node_type()};
+    }
+
+    iterator insert(const_iterator hint, node_type&& nh) {
+        if (nh.empty())
+            return end();
+        assert(nh.get_allocator() == get_allocator());
+
+        size_t n = size();
+        iterator result = insert(hint, std::move_if_noexcept(*nh.element));
+        if (size() != n)
+            nh = node_type();
         return result;
     }
 
+    // Moves every element of source that *this does not have yet over to
+    // *this; source keeps the rest. The allocators must compare equal. An
+    // empty set with a stateless comparator takes the whole tree of source
+    // over in O(1). Otherwise each moved element is moved into a slot of
+    // *this, as with node_type, and its slot in source is only freed for
+    // reuse by source; the slabs of source go back to the allocator when it
+    // is left empty, so memory peaks at both sets until then. If a
+    // comparison or an allocation throws, every element is still in
+    // exactly one of the two sets.
+    void merge(set& source) {
+        assert(alloc() == source.alloc());
+        if (this == &source || source.empty())
+            return;
+        if (empty() && std::is_empty_v<Compare>) {
+            swap_contents(source);
+            return;
+        }
+
+        tree &t = _tree.t;
+        base_node *hint = &t.root;
+        for (const_iterator i = source.begin(); i != source.end();) {
+            node *v = const_cast<node*>(static_cast<node const*>(i.ptr));
+            base_node *p;
+            bool left;
+            if (node *found = locate_near(t, hint, v->data, p, left)) {
+                hint = found;
+                ++i;
+                continue;
+            }
+
+            node *w = create_node(p, std::move_if_noexcept(v->data));
+            attach(t, w, p, left);
+            hint = w;
+            i = source.erase(i);
+        }
+        if (source.empty())
+            source.clear();
+    }
+
+    // Set algebra in place, with other ordered the same way. For m elements
+    // in other and n in *this, unite(), subtract() and symmetric_subtract()
+    // insert or erase the elements of other one by one when m < n / 8, each
+    // search starting from the previous one: O(m log(n / m + 1)) on a
+    // balanced tree. Otherwise, and always for intersect(), *this gets the
+    // result of the out-of-place operation below. If an exception is thrown
+    // by the element-wise way, part of the elements may have been done.
+    void unite(set const& other) {
+        if (other.empty() || this == &other)
+            return;
+        if (other.size() >= size() / 8) {
+            replace(set_union(*this, other));
+            return;
+        }
+
+        finger f{*this};
+        for (T const& x: other) {
+            const_iterator r = f.lower_bound(x);
+            if (!f.equal)
+                insert(r, x);
+        }
+    }
+
+    void intersect(set const& other) {
+        if (this != &other)
+            replace(set_intersection(*this, other));
+    }
+
+    void subtract(set const& other) {
+        if (other.empty())
+            return;
+        if (this == &other) {
+            clear();
+            return;
+        }
+        if (other.size() >= size() / 8) {
+            replace(set_difference(*this, other));
+            return;
+        }
+
+        finger f{*this};
+        for (T const& x: other) {
+            const_iterator r = f.lower_bound(x);
+            if (r == end())
+                break;
+            if (f.equal)
+                f.last = erase(r).ptr;
+        }
+    }
+
+    void symmetric_subtract(set const& other) {
+        if (other.empty())
+            return;
+        if (this == &other) {
+            clear();
+            return;
+        }
+        if (other.size() >= size() / 8) {
+            replace(set_symmetric_difference(*this, other));
+            return;
+        }
+
+        finger f{*this};
+        for (T const& x: other) {
+            const_iterator r = f.lower_bound(x);
+            if (f.equal)
+                f.last = erase(r).ptr;
+            else
+                insert(r, x);
+        }
+    }
+
+    // Removes the elements for which pred returns true, in order, and
+    // returns their number. Every run of them is removed with one range
+    // erase.
+    template<typename Predicate>
+    friend size_t erase_if(set& c, Predicate pred) {
+        size_t n = c.size();
+        for (const_iterator i = c.begin(); i != c.end();) {
+            if (!pred(*i)) {
+                ++i;
+                continue;
+            }
+            const_iterator j = std::next(i);
+            while (j != c.end() && pred(*j))
+                ++j;
+            i = c.erase(i, j);
+        }
+        return n - c.size();
+    }
+
+    // Set algebra into a new set, which has the order and the allocator of
+    // a and copies of the elements, taken from a where both have one. The
+    // result is a balanced tree in one slab. Union and symmetric difference
+    // merge the two sets in O(n + m). Intersection, and difference when a
+    // is the smaller set, search the larger set for each element of the
+    // smaller one, starting from the previous match: O(m log(n / m + 1))
+    // for m <= n elements, if the larger tree is balanced.
+    friend set set_union(set const& a, set const& b) {
+        if (b.empty() || &a == &b)
+            return a;
+
+        const_iterator i = a.begin(), j = b.begin();
+        return build_from(a, a.size() + b.size(), [&]() -> T const* {
+            if (i == a.end())
+                return j == b.end() ? nullptr : &*j++;
+            if (j == b.end())
+                return &*i++;
+            int c = a.compare(i, j);
+            if (c > 0)
+                return &*j++;
+            if (c == 0)
+                ++j;
+            return &*i++;
+        });
+    }
+
+    friend set set_intersection(set const& a, set const& b) {
+        if (&a == &b)
+            return a;
+
+        bool small_a = a.size() <= b.size();
+        set const &s = small_a ? a : b;
+        finger f{small_a ? b : a};
+        const_iterator i = s.begin();
+        return build_from(a, s.size(), [&]() -> T const* {
+            while (i != s.end()) {
+                T const &x = *i++;
+                const_iterator r = f.lower_bound(x);
+                if (r == f.owner.end())
+                    break;
+                if (f.equal)
+                    return small_a ? &x : &*r;
+            }
+            return nullptr;
+        });
+    }
+
+    friend set set_difference(set const& a, set const& b) {
+        if (b.empty())
+            return a;
+        if (&a == &b)
+            return set(a.comp(), a.get_allocator());
+
+        const_iterator i = a.begin(), j = b.begin();
+        if (a.size() <= b.size()) {
+            finger f{b};
+            return build_from(a, a.size(), [&]() -> T const* {
+                while (i != a.end()) {
+                    T const &x = *i++;
+                    f.lower_bound(x);
+                    if (!f.equal)
+                        return &x;
+                }
+                return nullptr;
+            });
+        }
+
+        return build_from(a, a.size(), [&]() -> T const* {
+            while (i != a.end()) {
+                if (j == b.end())
+                    return &*i++;
+                int c = a.compare(i, j);
+                if (c < 0)
+                    return &*i++;
+                if (c == 0)
+                    ++i;
+                ++j;
+            }
+            return nullptr;
+        });
+    }
+
+    friend set set_symmetric_difference(set const& a, set const& b) {
+        if (b.empty())
+            return a;
+        if (&a == &b)
+            return set(a.comp(), a.get_allocator());
+
+        const_iterator i = a.begin(), j = b.begin();
+        return build_from(a, a.size() + b.size(), [&]() -> T const* {
+            for (;;) {
+                if (i == a.end())
+                    return j == b.end() ? nullptr : &*j++;
+                if (j == b.end())
+                    return &*i++;
+                int c = a.compare(i, j);
+                if (c < 0)
+                    return &*i++;
+                if (c > 0)
+                    return &*j++;
+                ++i;
+                ++j;
+            }
+        });
+    }
+
     size_t size() const {
-        return _size;
+        return _tree.t.size;
+    }
+
+    // Memory held by a set, see memory_breakdown().
+    struct memory_stats {
+        size_t nodes;              // elements
+        size_t node_bytes;         // size of a node, padding included
+        size_t slab_bytes;         // node storage obtained from the allocator
+        size_t unused_slots;       // free or not yet used node slots
+        size_t allocations;        // blocks obtained from the allocator
+        size_t allocator_overhead; // estimated bookkeeping of a general purpose allocator
+        size_t element_heap_bytes; // owned by the elements, see set_heap_usage
+
+        size_t total() const noexcept {
+            return slab_bytes + allocator_overhead + element_heap_bytes;
+        }
+    };
+
+    // Heap memory held by the set, not counting sizeof(*this).
+    size_t memory_usage() const noexcept {
+        return memory_breakdown().total();
+    }
+
+    // O(number of slabs + unused slots), plus O(size()) when set_heap_usage
+    // is specialized for T.
+    memory_stats memory_breakdown() const noexcept {
+        memory_stats result{};
+        result.node_bytes = sizeof(node);
+        tree const &t = _tree.t;
+        result.nodes = t.size;
+        for (slab const *s = t.pool.slabs; s; s = s->next) {
+            result.slab_bytes += s->slots * sizeof(node);
+            result.allocations++;
+        }
+        result.unused_slots = t.pool.bump_end - t.pool.bump;
+        for (free_slot const *f = t.pool.free; f; f = f->next)
+            result.unused_slots++;
+        // Two words per block is what glibc malloc spends on a chunk.
+        result.allocator_overhead = result.allocations * 2 * sizeof(void*);
+
+        if constexpr (std::is_invocable_r_v<size_t, set_heap_usage<T> const&, T const&>) {
+            set_heap_usage<T> usage;
+            for (auto &e: *this)
+                result.element_heap_bytes += usage(e);
+        }
+        return result;
+    }
+
+#ifdef SET_MEMORY_REGISTRY
+    // Counters of all live sets of this type.
+    static set_memory_registry::entry const& memory_registry() noexcept {
+        return registry();
     }
+#endif
 
     bool empty() const {
-        return _size == 0;
+        return size() == 0;
     }
 
     void clear() {
-        if (root.left)
-            delete root.left;
-        root.left = nullptr;
-        _size = 0;
+        destroy_nodes(_tree.t);
     }
 
-    friend void swap(set<T>& a, set<T>& b) {
-        std::swap(a._size, b._size);
-        std::swap(a.root.left, b.root.left);
+    // Moves all nodes to a single slab in in-order, so that iteration walks
+    // memory sequentially, and rebuilds the tree balanced. Invalidates all
+    // iterators, pointers and references to elements of *this but end().
+    // If an exception is thrown, there are no effects.
+    void compact() {
+        size_t n = size();
+        if (n == 0) {
+            clear();
+            return;
+        }
+
+        tree &t = _tree.t;
+        iterator i = begin();
+        node *storage = fill_slab(n, [&](node* slot) {
+            node *v = const_cast<node*>(static_cast<node const*>((i++).ptr));
+            node_traits::construct(alloc(), slot, nullptr, std::move_if_noexcept(v->data));
+        });
+
+        destroy_nodes(t);
+        install_sorted_slab(t, storage, n, n);
+    }
+
+    // Same as clear(), but the nodes are destroyed by set_reclaimer on a
+    // background thread and the call does not wait for it. When there is
+    // nothing to destroy elementwise, or the work can not be handed over,
+    // this is clear().
+    void clear_async() {
+        if (trivial_teardown || empty()) {
+            clear();
+            return;
+        }
+
+        detached *d;
+        try {
+            d = new detached(comp(), get_allocator());
+        } catch (...) {
+            clear();
+            return;
+        }
+        swap_contents(d->owner);
+        if (!set_reclaimer::instance().post(d))
+            delete d;
+    }
+
+    // Without propagate_on_container_swap the allocators must compare equal.
+    // end() of each set stays with it.
+    friend void swap(set& a, set& b) noexcept {
+        using std::swap;
+        if constexpr (alloc_traits::propagate_on_container_swap::value)
+            swap(a.alloc(), b.alloc());
+        swap(a.comp(), b.comp());
+        a.swap_contents(b);
+    }
+};
+
+template<typename T, typename Compare, typename Allocator>
+struct set<T, Compare, Allocator>::detached: set_reclaimer::task {
+    set owner;
 
-        if (a.root.left)
-            a.root.left->parent = &a.root;
+    detached(Compare const& comp, Allocator const& alloc): owner(comp, alloc) {}
 
-        if (b.root.left)
-            b.root.left->parent = &b.root;
+    void run() noexcept override {
+        owner.clear();
     }
 };
 
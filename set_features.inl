@@ -0,0 +1,1432 @@
+// Tests of set-specific behaviour which is not a part of the common
+// container interface checked by set_testing.inl.
+
+TEST(features, copies_are_independent)
+{
+counted::no_new_instances_guard g;
+
+container c;
+mass_insert(c, {3, 1, 4, 2});
+container c2 = c;
+container::iterator i = c2.begin();
+c.erase(c.find(1));
+EXPECT_EQ(1, *i);
+EXPECT_NE(&*c.find(3), &*c2.find(3));
+expect_eq(c2, {1, 2, 3, 4});
+expect_eq(c, {2, 3, 4});
+container::iterator j = c.find(3);
+c.insert(5);
+c.erase(j);
+expect_eq(c2, {1, 2, 3, 4});
+expect_eq(c, {2, 4, 5});
+}
+
+TEST(features, end_is_stable)
+{
+counted::no_new_instances_guard g;
+
+container c;
+container::iterator e = c.end();
+c.insert(1);
+EXPECT_EQ(e, ++c.begin());
+container c2 = c;
+container::iterator e2 = c2.end();
+c2.insert(2);
+EXPECT_EQ(e2, std::next(c2.begin(), 2));
+c.clear();
+EXPECT_EQ(e, c.end());
+EXPECT_EQ(e, c.begin());
+c.insert(3);
+EXPECT_EQ(e, ++c.find(3));
+c = c2;
+EXPECT_EQ(e, c.end());
+c.compact();
+c.clear_async();
+set_reclaimer::instance().wait();
+EXPECT_EQ(e, c.end());
+c = container(c2);
+EXPECT_EQ(e, c.end());
+EXPECT_EQ(e, std::next(c.begin(), 2));
+c.erase(c.begin(), c.end());
+EXPECT_EQ(e, c.end());
+}
+
+TEST(fault_injection, insert_into_copy)
+{
+faulty_run([]
+{
+container c;
+mass_insert(c, {3, 2, 4, 1});
+container c2 = c;
+try
+{
+c2.insert(5);
+}
+catch (...)
+{
+fault_injection_disable dg;
+expect_eq(c2, {1, 2, 3, 4});
+throw;
+}
+fault_injection_disable dg;
+expect_eq(c, {1, 2, 3, 4});
+expect_eq(c2, {1, 2, 3, 4, 5});
+});
+}
+
+TEST(features, erased_nodes_reused)
+{
+counted::no_new_instances_guard g;
+
+container c;
+mass_insert(c, {3, 1, 4, 2});
+counted const* p = &*c.find(4);
+c.erase(c.find(4));
+EXPECT_EQ(p, &*c.insert(5).first);
+expect_eq(c, {1, 2, 3, 5});
+}
+
+TEST(features, nodes_are_contiguous)
+{
+counted::no_new_instances_guard g;
+
+container c;
+mass_insert(c, {1, 2, 3, 4});
+char const* p1 = reinterpret_cast<char const*>(&*c.find(1));
+char const* p2 = reinterpret_cast<char const*>(&*c.find(2));
+char const* p3 = reinterpret_cast<char const*>(&*c.find(3));
+char const* p4 = reinterpret_cast<char const*>(&*c.find(4));
+EXPECT_EQ(p2 - p1, p3 - p2);
+EXPECT_EQ(p3 - p2, p4 - p3);
+}
+
+TEST(features, trivial_teardown)
+{
+set<int> c;
+for (int i = 0; i != 100; ++i)
+    c.insert(i * 37 % 100);
+set<int> c2 = c;
+c.clear();
+EXPECT_TRUE(c.empty());
+EXPECT_EQ(100u, c2.size());
+c.insert(5);
+c.insert(3);
+c2 = c;
+EXPECT_EQ(2u, c2.size());
+EXPECT_EQ(3, *c2.begin());
+}
+
+TEST(features, deep_teardown)
+{
+// Inserting at end() builds a chain as deep as the set is large; tearing it
+// down must not recurse.
+int const n = 1 << 21;
+{
+    set<int> c;
+    for (int i = 0; i != n; ++i)
+        c.insert(c.end(), i);
+    EXPECT_EQ(size_t(n), c.size());
+}
+set<int> c;
+for (int i = 0; i != n; ++i)
+    c.insert(c.end(), i);
+c.clear();
+EXPECT_TRUE(c.empty());
+c.insert(1);
+EXPECT_EQ(1, *c.begin());
+}
+
+TEST(features, compact)
+{
+counted::no_new_instances_guard g;
+
+container c;
+mass_insert(c, {5, 3, 8, 1, 4, 7, 9, 2, 6});
+c.erase(c.find(4));
+c.erase(c.find(8));
+c.insert(10);
+c.compact();
+expect_eq(c, {1, 2, 3, 5, 6, 7, 9, 10});
+
+char const* prev = reinterpret_cast<char const*>(&*c.begin());
+char const* next = reinterpret_cast<char const*>(&*std::next(c.begin()));
+for (auto i = std::next(c.begin()); i != c.end(); ++i)
+{
+    char const* p = reinterpret_cast<char const*>(&*i);
+    EXPECT_EQ(next - reinterpret_cast<char const*>(&*c.begin()), p - prev);
+    prev = p;
+}
+
+c.insert(4);
+c.erase(c.find(1));
+expect_eq(c, {2, 3, 4, 5, 6, 7, 9, 10});
+}
+
+TEST(features, compact_copy)
+{
+counted::no_new_instances_guard g;
+
+container c;
+mass_insert(c, {3, 1, 2, 4});
+container c2 = c;
+container::iterator i = c.begin();
+c2.compact();
+EXPECT_EQ(1, *i);
+expect_eq(c, {1, 2, 3, 4});
+expect_eq(c2, {1, 2, 3, 4});
+c2.erase(c2.find(3));
+expect_eq(c, {1, 2, 3, 4});
+expect_eq(c2, {1, 2, 4});
+}
+
+TEST(fault_injection, compact)
+{
+faulty_run([]
+{
+container c;
+mass_insert(c, {3, 2, 4, 1});
+container c2 = c;
+try
+{
+c2.compact();
+c.compact();
+}
+catch (...)
+{
+fault_injection_disable dg;
+expect_eq(c, {1, 2, 3, 4});
+expect_eq(c2, {1, 2, 3, 4});
+throw;
+}
+fault_injection_disable dg;
+expect_eq(c, {1, 2, 3, 4});
+expect_eq(c2, {1, 2, 3, 4});
+});
+}
+
+TEST(features, clear_async)
+{
+counted::no_new_instances_guard g;
+
+container c;
+mass_insert(c, {3, 1, 4, 2});
+container c2 = c;
+c.clear_async();
+EXPECT_TRUE(c.empty());
+expect_eq(c2, {1, 2, 3, 4});
+c2.clear_async();
+EXPECT_TRUE(c2.empty());
+set_reclaimer::instance().wait();
+g.expect_no_instances();
+c.insert(5);
+expect_eq(c, {5});
+}
+
+TEST(features, memory_breakdown)
+{
+counted::no_new_instances_guard g;
+
+container c;
+EXPECT_EQ(0u, c.memory_usage());
+mass_insert(c, {3, 1, 4, 2});
+container::memory_stats m = c.memory_breakdown();
+EXPECT_EQ(4u, m.nodes);
+EXPECT_GE(m.node_bytes, sizeof(counted));
+EXPECT_EQ(m.slab_bytes, (m.nodes + m.unused_slots + 1) * m.node_bytes);
+EXPECT_EQ(1u, m.allocations);
+EXPECT_EQ(0u, m.element_heap_bytes);
+EXPECT_EQ(m.total(), c.memory_usage());
+
+c.erase(c.find(2));
+EXPECT_EQ(m.unused_slots + 1, c.memory_breakdown().unused_slots);
+}
+
+template <>
+struct set_heap_usage<std::string>
+{
+    size_t operator()(std::string const& s) const noexcept
+    {
+        return s.capacity() > 15 ? s.capacity() + 1 : 0;
+    }
+};
+
+TEST(features, element_heap_usage)
+{
+set<std::string> c;
+c.insert("short");
+c.insert(std::string(100, 'x'));
+EXPECT_GE(c.memory_breakdown().element_heap_bytes, 101u);
+}
+
+#ifdef SET_MEMORY_REGISTRY
+TEST(features, memory_registry)
+{
+counted::no_new_instances_guard g;
+
+auto const& r = container::memory_registry();
+size_t sets = r.sets, nodes = r.nodes, bytes = r.bytes;
+bool listed = false;
+set_memory_registry::for_each([&](set_memory_registry::entry const& e)
+{
+    listed = listed || &e == &r;
+});
+EXPECT_TRUE(listed);
+{
+    container c;
+    mass_insert(c, {3, 1, 4, 2});
+    container c2 = c;
+    EXPECT_EQ(sets + 2, r.sets);
+    EXPECT_EQ(nodes + 8, r.nodes);
+    EXPECT_EQ(bytes + c.memory_breakdown().slab_bytes + c2.memory_breakdown().slab_bytes, r.bytes);
+    c.erase(c.find(1));
+    EXPECT_EQ(nodes + 7, r.nodes);
+    c.compact();
+    EXPECT_EQ(nodes + 7, r.nodes);
+}
+EXPECT_EQ(sets, r.sets);
+EXPECT_EQ(nodes, r.nodes);
+EXPECT_EQ(bytes, r.bytes);
+}
+#endif
+
+struct prefixed
+{
+    std::string s;
+    static size_t comparisons;
+
+    friend bool operator<(prefixed const& a, prefixed const& b)
+    {
+        ++comparisons;
+        return a.s < b.s;
+    }
+};
+
+size_t prefixed::comparisons = 0;
+
+template <>
+struct set_key_prefix<prefixed>
+{
+    std::uint64_t operator()(prefixed const& k) const noexcept
+    {
+        return set_bytes_prefix(k.s.data(), k.s.size());
+    }
+};
+
+TEST(features, key_prefix)
+{
+set<prefixed> c;
+for (char const* s : {"pear", "apple", "plum", "apricot", "fig", "kiwi", "lime", "quince"})
+    c.insert({s});
+
+prefixed::comparisons = 0;
+EXPECT_EQ("kiwi", c.find({"kiwi"})->s);
+EXPECT_EQ(c.end(), c.find({"melon"}));
+EXPECT_EQ("pear", c.lower_bound({"orange"})->s);
+EXPECT_EQ("plum", c.upper_bound({"pear"})->s);
+EXPECT_EQ(3u, prefixed::comparisons);
+}
+
+TEST(features, key_prefix_ties)
+{
+set<prefixed> c;
+for (char const* s : {"abcdefgh2", "abcdefgh", "abcdefgh10", "", "abc", "abcdefgi"})
+    c.insert({s});
+
+std::vector<std::string> elems;
+for (auto const& e : c)
+    elems.push_back(e.s);
+EXPECT_EQ((std::vector<std::string>{"", "abc", "abcdefgh", "abcdefgh10", "abcdefgh2", "abcdefgi"}), elems);
+EXPECT_EQ("abcdefgh10", c.find({"abcdefgh10"})->s);
+EXPECT_EQ("abcdefgh2", c.lower_bound({"abcdefgh11"})->s);
+EXPECT_EQ(c.end(), c.upper_bound({"abcdefgi"}));
+c.insert({std::string("abc\0", 4)});
+EXPECT_EQ(std::string("abc\0", 4), std::next(c.begin(), 2)->s);
+}
+
+TEST(features, move_steals_tree)
+{
+counted::no_new_instances_guard g;
+
+container c;
+mass_insert(c, {3, 1, 4, 2});
+counted const* p = &*c.find(3);
+container::iterator i = c.begin();
+container::iterator e = c.end();
+container c2 = std::move(c);
+EXPECT_TRUE(c.empty());
+EXPECT_EQ(p, &*c2.find(3));
+EXPECT_EQ(c2.begin(), i);
+EXPECT_EQ(c.end(), e);
+
+c = std::move(c2);
+EXPECT_TRUE(c2.empty());
+EXPECT_EQ(p, &*c.find(3));
+}
+
+TEST(features, vector_of_sets)
+{
+counted::no_new_instances_guard g;
+
+std::vector<container> v(1);
+mass_insert(v[0], {2, 1});
+counted const* p = &*v[0].begin();
+for (int i = 0; i != 100; ++i)
+    v.emplace_back();
+EXPECT_EQ(p, &*v[0].begin());
+}
+
+struct copy_counted
+{
+    int value;
+    static size_t copies;
+
+    copy_counted(int value) : value(value) {}
+    copy_counted(copy_counted const& other) : value(other.value) { ++copies; }
+    copy_counted(copy_counted&& other) noexcept = default;
+
+    friend bool operator<(copy_counted const& a, copy_counted const& b)
+    {
+        return a.value < b.value;
+    }
+};
+
+size_t copy_counted::copies = 0;
+
+TEST(features, insert_without_copies)
+{
+set<copy_counted> c;
+copy_counted::copies = 0;
+c.insert(copy_counted(2));
+c.emplace(1);
+c.emplace(1);
+copy_counted v(3);
+c.insert(std::move(v));
+EXPECT_EQ(3u, c.size());
+EXPECT_EQ(0u, copy_counted::copies);
+set<copy_counted> c2 = std::move(c);
+c = std::move(c2);
+EXPECT_EQ(0u, copy_counted::copies);
+EXPECT_EQ(1, c.begin()->value);
+}
+
+struct compare_counted
+{
+    int value;
+    static size_t comparisons;
+
+    compare_counted(int value) : value(value) {}
+
+    friend bool operator<(compare_counted const& a, compare_counted const& b)
+    {
+        ++comparisons;
+        return a.value < b.value;
+    }
+};
+
+size_t compare_counted::comparisons = 0;
+
+TEST(features, copy_without_comparisons)
+{
+set<compare_counted> c;
+for (int i = 0; i != 1000; ++i)
+    c.insert(c.end(), i);
+set<compare_counted> c2 = c;
+compare_counted::comparisons = 0;
+c2.insert(-1);
+EXPECT_GT(10u, compare_counted::comparisons);
+EXPECT_EQ(1000u, c.size());
+EXPECT_EQ(1001u, c2.size());
+EXPECT_EQ(-1, c2.begin()->value);
+EXPECT_EQ(999, c2.rbegin()->value);
+int expected = -1;
+for (compare_counted const& e : c2)
+    EXPECT_EQ(expected++, e.value);
+EXPECT_EQ(1000, expected);
+}
+
+TEST(features, assign_larger_keeps_depth)
+{
+std::vector<compare_counted> v;
+for (int i = 0; i != 1000; ++i)
+    v.push_back(i);
+set<compare_counted> c(v.begin(), v.end());
+set<compare_counted> c2(v.begin(), v.begin() + 600);
+c2 = c;
+compare_counted::comparisons = 0;
+EXPECT_EQ(999, c2.find(999)->value);
+EXPECT_EQ(800, c2.find(800)->value);
+EXPECT_GT(100u, compare_counted::comparisons);
+EXPECT_EQ(1000u, c2.size());
+int expected = 0;
+for (compare_counted const& e : c2)
+    EXPECT_EQ(expected++, e.value);
+EXPECT_EQ(1000, expected);
+}
+
+TEST(features, copy_keeps_shape)
+{
+counted::no_new_instances_guard g;
+
+container c;
+mass_insert(c, {5, 2, 8, 1, 3, 7, 9, 4, 6});
+c.erase(c.find(5));
+container c2 = c;
+c2.insert(10);
+c.insert(0);
+expect_eq(c, {0, 1, 2, 3, 4, 6, 7, 8, 9});
+expect_eq(c2, {1, 2, 3, 4, 6, 7, 8, 9, 10});
+for (int i = 1; i != 10; ++i)
+{
+    if (i != 5)
+    {
+        EXPECT_EQ(i, *c2.find(i));
+    }
+}
+EXPECT_EQ(c2.end(), c2.find(5));
+c2.erase(c2.find(2));
+c2.erase(c2.find(7));
+expect_eq(c2, {1, 3, 4, 6, 8, 9, 10});
+expect_eq(c, {0, 1, 2, 3, 4, 6, 7, 8, 9});
+}
+
+TEST(features, emplace)
+{
+counted::no_new_instances_guard g;
+
+container c;
+EXPECT_TRUE(c.emplace(3).second);
+EXPECT_TRUE(c.emplace(1).second);
+counted const* p = &*c.find(1);
+auto r = c.emplace(3);
+EXPECT_FALSE(r.second);
+EXPECT_EQ(3, *r.first);
+container c2 = c;
+r = c.emplace(1);
+EXPECT_FALSE(r.second);
+EXPECT_EQ(p, &*r.first);
+EXPECT_TRUE(c.emplace(2).second);
+expect_eq(c, {1, 2, 3});
+expect_eq(c2, {1, 3});
+}
+
+TEST(fault_injection, emplace)
+{
+faulty_run([]
+{
+container c;
+mass_insert(c, {3, 1});
+container c2 = c;
+try
+{
+c.emplace(2);
+}
+catch (...)
+{
+fault_injection_disable dg;
+expect_eq(c, {1, 3});
+expect_eq(c2, {1, 3});
+throw;
+}
+try
+{
+c2.emplace(3);
+c2.emplace(4);
+}
+catch (...)
+{
+fault_injection_disable dg;
+expect_eq(c, {1, 2, 3});
+expect_eq(c2, {1, 3});
+throw;
+}
+fault_injection_disable dg;
+expect_eq(c, {1, 2, 3});
+expect_eq(c2, {1, 3, 4});
+});
+}
+
+TEST(features, insert_hint)
+{
+counted::no_new_instances_guard g;
+
+container c;
+for (int i = 5; i != 10; ++i)
+    EXPECT_EQ(i, *c.insert(c.end(), i));
+for (int i = 4; i != 0; --i)
+    EXPECT_EQ(i, *c.insert(c.begin(), i));
+container::iterator i = c.find(7);
+EXPECT_EQ(7, *c.insert(i, 7));
+EXPECT_EQ(0, *c.insert(i, 0));
+EXPECT_EQ(11, *c.insert(i, 11));
+EXPECT_EQ(10, *c.emplace_hint(c.end(), 10));
+EXPECT_EQ(c.find(3), c.emplace_hint(c.begin(), 3));
+expect_eq(c, {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11});
+}
+
+TEST(features, insert_hint_after_erase)
+{
+counted::no_new_instances_guard g;
+
+container c;
+mass_insert(c, {5, 3, 8, 1, 9});
+c.erase(c.find(9));
+c.erase(c.begin());
+c.insert(c.end(), 10);
+c.insert(c.begin(), 2);
+c.erase(c.find(10));
+c.erase(c.find(8));
+c.erase(c.find(5));
+c.insert(c.end(), 4);
+expect_eq(c, {2, 3, 4});
+EXPECT_EQ(2, *c.begin());
+c.clear();
+EXPECT_EQ(c.end(), c.begin());
+c.insert(c.end(), 1);
+c.insert(c.begin(), 0);
+expect_eq(c, {0, 1});
+}
+
+TEST(features, insert_hint_copy)
+{
+counted::no_new_instances_guard g;
+
+container c;
+mass_insert(c, {1, 3});
+container c2 = c;
+container::iterator i = c.insert(c.find(3), 2);
+EXPECT_EQ(2, *i);
+EXPECT_EQ(3, *c2.emplace_hint(c2.end(), 3));
+expect_eq(c, {1, 2, 3});
+expect_eq(c2, {1, 3});
+}
+
+TEST(fault_injection, insert_hint)
+{
+faulty_run([]
+{
+container c;
+mass_insert(c, {3, 1, 5});
+container c2 = c;
+try
+{
+c.insert(c.find(3), 2);
+c.emplace_hint(c.end(), 6);
+c2.emplace_hint(c2.begin(), 0);
+}
+catch (...)
+{
+fault_injection_disable dg;
+expect_eq(c2, {1, 3, 5});
+throw;
+}
+fault_injection_disable dg;
+expect_eq(c, {1, 2, 3, 5, 6});
+expect_eq(c2, {0, 1, 3, 5});
+});
+}
+
+TEST(features, range_ctor_sorted)
+{
+counted::no_new_instances_guard g;
+
+std::vector<counted> v;
+for (int i = 0; i != 100; ++i)
+    v.push_back(i);
+container c(v.begin(), v.end());
+EXPECT_EQ(100u, c.size());
+EXPECT_TRUE(std::equal(c.begin(), c.end(), v.begin(), v.end()));
+EXPECT_TRUE(std::equal(c.rbegin(), c.rend(), v.rbegin(), v.rend()));
+container::memory_stats m = c.memory_breakdown();
+EXPECT_EQ(1u, m.allocations);
+EXPECT_EQ(0u, m.unused_slots);
+
+c.erase(c.find(50));
+c.insert(c.end(), 100);
+c.insert(-1);
+EXPECT_EQ(-1, *c.begin());
+EXPECT_EQ(100, *c.rbegin());
+EXPECT_EQ(c.end(), c.find(50));
+EXPECT_EQ(51, *c.upper_bound(49));
+}
+
+TEST(features, range_ctor_unsorted)
+{
+counted::no_new_instances_guard g;
+
+std::vector<int> v = {4, 2, 2, 6, 1, 5};
+container c(v.begin(), v.end());
+expect_eq(c, {1, 2, 4, 5, 6});
+
+std::istringstream in("3 1 2 3");
+container c2{std::istream_iterator<int>(in), std::istream_iterator<int>()};
+expect_eq(c2, {1, 2, 3});
+}
+
+TEST(features, range_insert)
+{
+counted::no_new_instances_guard g;
+
+std::vector<counted> v;
+for (int i : {1, 3, 5, 7})
+    v.push_back(i);
+container c;
+c.insert(v.begin(), v.end());
+container c2 = c;
+c.insert(v.begin(), v.end());
+expect_eq(c, {1, 3, 5, 7});
+std::vector<counted> w;
+for (int i : {0, 2, 4, 8})
+    w.push_back(i);
+c.insert(sorted_unique, w.begin(), w.end());
+expect_eq(c, {0, 1, 2, 3, 4, 5, 7, 8});
+expect_eq(c2, {1, 3, 5, 7});
+
+container c3(sorted_unique, w.begin(), w.end());
+expect_eq(c3, {0, 2, 4, 8});
+c3.clear();
+c3.insert(w.begin() + 1, w.begin() + 2);
+expect_eq(c3, {2});
+}
+
+TEST(fault_injection, range_ctor)
+{
+faulty_run([]
+{
+std::vector<counted> v;
+for (int i = 0; i != 10; ++i)
+    v.push_back(i);
+container c(v.begin(), v.end());
+fault_injection_disable dg;
+EXPECT_EQ(10u, c.size());
+});
+}
+
+TEST(features, extract)
+{
+counted::no_new_instances_guard g;
+
+container c;
+mass_insert(c, {3, 1, 4, 2});
+container::node_type nh = c.extract(c.find(3));
+EXPECT_FALSE(nh.empty());
+EXPECT_EQ(3, nh.value());
+expect_eq(c, {1, 2, 4});
+EXPECT_TRUE(c.extract(5).empty());
+
+nh.value() = 5;
+container::insert_return_type r = c.insert(std::move(nh));
+EXPECT_TRUE(r.inserted);
+EXPECT_EQ(5, *r.position);
+EXPECT_TRUE(r.node.empty());
+EXPECT_TRUE(nh.empty());
+expect_eq(c, {1, 2, 4, 5});
+
+container c2;
+c2.insert(4);
+nh = c.extract(4);
+r = c2.insert(std::move(nh));
+EXPECT_FALSE(r.inserted);
+EXPECT_EQ(c2.begin(), r.position);
+EXPECT_EQ(4, r.node.value());
+EXPECT_EQ(c2.end(), c2.insert(c2.end(), container::node_type()));
+EXPECT_EQ(c.end(), c.insert(container::node_type()).position);
+EXPECT_EQ(4, *c.insert(c.begin(), std::move(r.node)));
+EXPECT_TRUE(r.node.empty());
+expect_eq(c, {1, 2, 4, 5});
+expect_eq(c2, {4});
+}
+
+TEST(features, extract_copy)
+{
+counted::no_new_instances_guard g;
+
+container c;
+mass_insert(c, {3, 1, 2});
+container c2 = c;
+container::node_type nh = c.extract(c.find(2));
+EXPECT_EQ(2, nh.value());
+expect_eq(c, {1, 3});
+expect_eq(c2, {1, 2, 3});
+EXPECT_FALSE(c2.insert(std::move(nh)).inserted);
+}
+
+TEST(features, extract_without_copies)
+{
+set<copy_counted> c, c2;
+c.emplace(2);
+c.emplace(1);
+c2.emplace(3);
+copy_counted::copies = 0;
+c2.insert(c.extract(c.begin()));
+c2.merge(c);
+c.merge(c2);
+EXPECT_EQ(0u, copy_counted::copies);
+EXPECT_TRUE(c2.empty());
+EXPECT_EQ(3u, c.size());
+EXPECT_EQ(1, c.begin()->value);
+EXPECT_EQ(3, c.rbegin()->value);
+}
+
+TEST(features, merge)
+{
+counted::no_new_instances_guard g;
+
+container c, c2;
+mass_insert(c, {1, 4, 6});
+mass_insert(c2, {7, 4, 2, 5, 1, 0});
+container c3 = c2;
+c.merge(c2);
+expect_eq(c, {0, 1, 2, 4, 5, 6, 7});
+expect_eq(c2, {1, 4});
+expect_eq(c3, {0, 1, 2, 4, 5, 7});
+c.merge(c);
+expect_eq(c, {0, 1, 2, 4, 5, 6, 7});
+c.merge(c3);
+expect_eq(c3, {0, 1, 2, 4, 5, 7});
+EXPECT_EQ(7u, c.size());
+}
+
+TEST(features, merge_into_empty)
+{
+counted::no_new_instances_guard g;
+
+container c, c2;
+mass_insert(c2, {2, 1, 3});
+container::const_iterator i = c2.find(2);
+counted const* p = &*i;
+c.merge(c2);
+EXPECT_TRUE(c2.empty());
+expect_eq(c, {1, 2, 3});
+EXPECT_EQ(p, &*c.find(2));
+EXPECT_EQ(c.begin(), --i);
+c2.insert(0);
+expect_eq(c2, {0});
+}
+
+TEST(features, merge_frees_emptied_source)
+{
+counted::no_new_instances_guard g;
+
+container c, c2;
+mass_insert(c, {1, 3});
+mass_insert(c2, {2, 4, 6});
+c.merge(c2);
+EXPECT_TRUE(c2.empty());
+EXPECT_EQ(0u, c2.memory_usage());
+expect_eq(c, {1, 2, 3, 4, 6});
+c2.insert(5);
+expect_eq(c2, {5});
+}
+
+TEST(fault_injection, merge)
+{
+faulty_run([]
+{
+container c, c2;
+mass_insert(c, {3, 1, 5});
+mass_insert(c2, {2, 5, 4, 0});
+try
+{
+c.merge(c2);
+}
+catch (...)
+{
+fault_injection_disable dg;
+std::vector<int> all;
+for (counted const& e : c)
+    all.push_back(e);
+for (counted const& e : c2)
+    all.push_back(e);
+std::sort(all.begin(), all.end());
+EXPECT_EQ((std::vector<int>{0, 1, 2, 3, 4, 5, 5}), all);
+throw;
+}
+fault_injection_disable dg;
+expect_eq(c, {0, 1, 2, 3, 4, 5});
+expect_eq(c2, {5});
+});
+}
+
+struct int_keyed
+{
+    int value;
+    static size_t constructed;
+
+    int_keyed(int value) : value(value) { ++constructed; }
+    int_keyed(int_keyed const& other) : value(other.value) { ++constructed; }
+
+    friend bool operator<(int_keyed const& a, int_keyed const& b)
+    {
+        return a.value < b.value;
+    }
+
+    friend bool operator<(int_keyed const& a, int b)
+    {
+        return a.value < b;
+    }
+
+    friend bool operator<(int a, int_keyed const& b)
+    {
+        return a < b.value;
+    }
+};
+
+size_t int_keyed::constructed = 0;
+
+TEST(features, transparent_lookup)
+{
+set<int_keyed> c;
+for (int i : {5, 1, 3, 7})
+    c.insert(i);
+int_keyed::constructed = 0;
+
+EXPECT_EQ(3, c.find(3)->value);
+EXPECT_EQ(c.end(), c.find(4));
+EXPECT_EQ(5, c.lower_bound(4)->value);
+EXPECT_EQ(5, c.lower_bound(5)->value);
+EXPECT_EQ(7, c.upper_bound(5)->value);
+EXPECT_EQ(c.end(), c.upper_bound(7));
+EXPECT_EQ(1u, c.count(7));
+EXPECT_EQ(0u, c.count(8));
+EXPECT_EQ(1u, c.erase(5));
+EXPECT_EQ(0u, c.erase(5));
+EXPECT_EQ(0u, int_keyed::constructed);
+EXPECT_EQ(3u, c.size());
+EXPECT_EQ(7, c.rbegin()->value);
+}
+
+TEST(features, transparent_lookup_counted)
+{
+container c;
+mass_insert(c, {5, 1, 3, 7});
+EXPECT_EQ(3, *c.find(3));
+EXPECT_EQ(5, *c.lower_bound(4));
+EXPECT_EQ(7, *c.upper_bound(5));
+EXPECT_EQ(1u, c.count(1));
+EXPECT_EQ(1u, c.erase(5));
+expect_eq(c, {1, 3, 7});
+}
+
+TEST(features, transparent_erase_copy)
+{
+counted::no_new_instances_guard g;
+
+container c;
+mass_insert(c, {2, 1, 3});
+container c2 = c;
+EXPECT_EQ(1u, c.erase(counted(2)));
+EXPECT_EQ(1u, c2.count(counted(2)));
+EXPECT_EQ(1u, c2.erase(3));
+expect_eq(c, {1, 3});
+expect_eq(c2, {1, 2});
+}
+
+struct only_from_int
+{
+    int value;
+
+    only_from_int(int value) : value(value) {}
+
+    friend bool operator<(only_from_int const& a, only_from_int const& b)
+    {
+        return a.value < b.value;
+    }
+};
+
+TEST(features, transparent_needs_comparison)
+{
+set<only_from_int> c;
+c.insert(1);
+c.insert(2);
+EXPECT_EQ(2, c.find(2)->value);
+EXPECT_EQ(1u, c.erase(1));
+EXPECT_EQ(1u, c.size());
+}
+
+TEST(features, arithmetic_keys_convert)
+{
+set<int> c;
+c.insert(-5);
+c.insert(3);
+EXPECT_EQ(3, *c.find(3u));
+EXPECT_EQ(1u, c.count(size_t(3)));
+EXPECT_EQ(3, *c.lower_bound(size_t(0)));
+EXPECT_EQ(3, *c.upper_bound(0u));
+EXPECT_EQ(-5, *c.lower_bound(-5L));
+EXPECT_EQ(1u, c.erase(3u));
+expect_eq(c, {-5});
+}
+
+static_assert(sizeof(set<int, std::greater<int>>) == sizeof(set<int>));
+
+TEST(features, custom_order)
+{
+counted::no_new_instances_guard g;
+
+set<counted, std::greater<counted>> c;
+for (int i : {3, 1, 4, 2})
+    c.insert(i);
+std::vector<int> v(c.begin(), c.end());
+EXPECT_EQ((std::vector<int>{4, 3, 2, 1}), v);
+EXPECT_EQ(3, *c.find(3));
+EXPECT_EQ(2, *c.lower_bound(counted(2)));
+EXPECT_EQ(1, *c.upper_bound(counted(2)));
+EXPECT_EQ(c.end(), c.upper_bound(counted(1)));
+EXPECT_FALSE(c.insert(4).second);
+c.erase(c.find(3));
+set<counted, std::greater<counted>> c2 = c;
+c2.insert(5);
+EXPECT_EQ(5, *c2.begin());
+EXPECT_EQ(3u, c.size());
+}
+
+struct reversed_key
+{
+    int value;
+
+    reversed_key(int value) : value(value) {}
+
+    friend bool operator<(reversed_key const& a, reversed_key const& b)
+    {
+        return a.value < b.value;
+    }
+};
+
+namespace std
+{
+template<>
+struct less<reversed_key>
+{
+    bool operator()(reversed_key const& a, reversed_key const& b) const
+    {
+        return b.value < a.value;
+    }
+};
+}
+
+TEST(features, specialized_less)
+{
+set<reversed_key> c;
+for (int i : {2, 1, 3})
+    c.insert(i);
+std::vector<int> v;
+for (reversed_key const& k : c)
+    v.push_back(k.value);
+EXPECT_EQ((std::vector<int>{3, 2, 1}), v);
+EXPECT_EQ(2, c.find(2)->value);
+EXPECT_EQ(1, c.upper_bound(2)->value);
+}
+
+TEST(features, pointer_order)
+{
+int a[3] = {};
+set<int*> c;
+for (int* p : {a + 2, a, a + 1})
+    c.insert(p);
+EXPECT_EQ(a, *c.begin());
+EXPECT_EQ(a + 2, *c.rbegin());
+EXPECT_EQ(1u, c.count(a + 1));
+}
+
+struct modulo_less
+{
+    int modulus;
+
+    bool operator()(int a, int b) const
+    {
+        return a % modulus < b % modulus;
+    }
+};
+
+TEST(features, stateful_order)
+{
+set<int, modulo_less> c(modulo_less{10});
+EXPECT_EQ(10, c.key_comp().modulus);
+EXPECT_TRUE(c.insert(13).second);
+EXPECT_TRUE(c.insert(21).second);
+EXPECT_FALSE(c.insert(3).second);
+EXPECT_EQ(21, *c.begin());
+EXPECT_EQ(13, *c.find(23));
+
+std::vector<int> v = {5, 11, 7};
+set<int, modulo_less> c2(v.begin(), v.end(), modulo_less{4});
+EXPECT_EQ(5, *c2.begin());
+EXPECT_EQ(11, *c2.rbegin());
+c2 = c;
+EXPECT_EQ(10, c2.key_comp().modulus);
+c2.insert(32);
+EXPECT_EQ(21, *c2.begin());
+EXPECT_EQ(3u, c2.size());
+set<int, modulo_less> c3(modulo_less{3});
+c3.insert(4);
+swap(c2, c3);
+EXPECT_EQ(3, c2.key_comp().modulus);
+EXPECT_EQ(10, c3.key_comp().modulus);
+}
+
+TEST(features, transparent_order)
+{
+set<int_keyed, std::less<>> c;
+for (int i : {5, 1, 3})
+    c.insert(i);
+int_keyed::constructed = 0;
+EXPECT_EQ(3, c.find(3)->value);
+EXPECT_EQ(5, c.lower_bound(4)->value);
+EXPECT_EQ(1u, c.erase(1));
+EXPECT_EQ(0u, int_keyed::constructed);
+}
+
+struct three_way_counted
+{
+    int value;
+    static size_t less_calls, three_way_calls;
+
+    three_way_counted(int value) : value(value) {}
+
+    friend bool operator<(three_way_counted const& a, three_way_counted const& b)
+    {
+        ++less_calls;
+        return a.value < b.value;
+    }
+};
+
+size_t three_way_counted::less_calls = 0;
+size_t three_way_counted::three_way_calls = 0;
+
+template<>
+struct set_three_way<three_way_counted>
+{
+    int operator()(three_way_counted const& a, three_way_counted const& b) const
+    {
+        ++three_way_counted::three_way_calls;
+        return (a.value > b.value) - (a.value < b.value);
+    }
+};
+
+TEST(features, three_way_comparison)
+{
+set<three_way_counted> c;
+for (int i = 0; i != 100; ++i)
+    c.insert(i * 37 % 100);
+three_way_counted::less_calls = 0;
+three_way_counted::three_way_calls = 0;
+
+for (int i = 0; i != 100; ++i)
+    EXPECT_EQ(i, c.find(i)->value);
+EXPECT_EQ(c.end(), c.find(100));
+EXPECT_EQ(50, c.lower_bound(50)->value);
+EXPECT_TRUE(c.insert(-1).second);
+EXPECT_FALSE(c.insert(7).second);
+EXPECT_EQ(0u, three_way_counted::less_calls);
+EXPECT_LT(0u, three_way_counted::three_way_calls);
+EXPECT_EQ(-1, c.begin()->value);
+EXPECT_EQ(101u, c.size());
+}
+
+TEST(features, set_algebra)
+{
+counted::no_new_instances_guard g;
+
+container a, b;
+mass_insert(a, {5, 1, 3, 7, 9});
+mass_insert(b, {4, 3, 8, 9, 0});
+expect_eq(set_union(a, b), {0, 1, 3, 4, 5, 7, 8, 9});
+expect_eq(set_intersection(a, b), {3, 9});
+expect_eq(set_difference(a, b), {1, 5, 7});
+expect_eq(set_difference(b, a), {0, 4, 8});
+expect_eq(set_symmetric_difference(a, b), {0, 1, 4, 5, 7, 8});
+expect_eq(a, {1, 3, 5, 7, 9});
+expect_eq(b, {0, 3, 4, 8, 9});
+
+container c = a;
+c.unite(b);
+expect_eq(c, {0, 1, 3, 4, 5, 7, 8, 9});
+c = a;
+c.intersect(b);
+expect_eq(c, {3, 9});
+c = a;
+c.subtract(b);
+expect_eq(c, {1, 5, 7});
+c = a;
+c.symmetric_subtract(b);
+expect_eq(c, {0, 1, 4, 5, 7, 8});
+c.symmetric_subtract(c);
+EXPECT_TRUE(c.empty());
+}
+
+TEST(features, set_algebra_sizes)
+{
+counted::no_new_instances_guard g;
+
+// Small second operands take the element-wise way in place.
+for (int n : {0, 1, 40, 300})
+    for (int m : {0, 1, 3, 40, 300})
+    {
+        container a, b;
+        std::vector<int> va, vb;
+        for (int i = 0; i != n; ++i)
+        {
+            a.insert(i * 3);
+            va.push_back(i * 3);
+        }
+        for (int i = 0; i != m; ++i)
+        {
+            b.insert(i * 5 - 20);
+            vb.push_back(i * 5 - 20);
+        }
+        std::sort(vb.begin(), vb.end());
+
+        auto check = [&](container const& c, auto op)
+        {
+            std::vector<int> expected;
+            op(va.begin(), va.end(), vb.begin(), vb.end(), std::back_inserter(expected));
+            std::vector<int> actual;
+            for (counted const& e : c)
+                actual.push_back(e);
+            EXPECT_EQ(expected, actual);
+        };
+        auto std_union = [](auto... args) { std::set_union(args...); };
+        auto std_intersection = [](auto... args) { std::set_intersection(args...); };
+        auto std_difference = [](auto... args) { std::set_difference(args...); };
+        auto std_symmetric_difference = [](auto... args) { std::set_symmetric_difference(args...); };
+
+        check(set_union(a, b), std_union);
+        check(set_intersection(a, b), std_intersection);
+        check(set_difference(a, b), std_difference);
+        check(set_symmetric_difference(a, b), std_symmetric_difference);
+
+        container c = a;
+        c.unite(b);
+        check(c, std_union);
+        c = a;
+        c.intersect(b);
+        check(c, std_intersection);
+        c = a;
+        c.subtract(b);
+        check(c, std_difference);
+        c = a;
+        c.symmetric_subtract(b);
+        check(c, std_symmetric_difference);
+        EXPECT_EQ(size_t(n), a.size());
+    }
+}
+
+TEST(features, set_algebra_equal_sets)
+{
+counted::no_new_instances_guard g;
+
+container a;
+mass_insert(a, {1, 2, 3});
+container b = a, c = a;
+expect_eq(set_union(a, b), {1, 2, 3});
+expect_eq(set_intersection(a, b), {1, 2, 3});
+EXPECT_TRUE(set_difference(a, b).empty());
+EXPECT_TRUE(set_symmetric_difference(a, b).empty());
+c.unite(c);
+c.intersect(c);
+expect_eq(c, {1, 2, 3});
+c.subtract(b);
+EXPECT_TRUE(c.empty());
+expect_eq(a, {1, 2, 3});
+expect_eq(b, {1, 2, 3});
+}
+
+TEST(features, intersection_is_output_sensitive)
+{
+std::vector<compare_counted> v;
+for (int i = 0; i != 1 << 14; ++i)
+    v.push_back(i);
+set<compare_counted> large(v.begin(), v.end()), small;
+for (int i = 0; i != 16; ++i)
+    small.insert(i * 1000 + 1);
+
+compare_counted::comparisons = 0;
+set<compare_counted> r = set_intersection(small, large);
+EXPECT_GT(1000u, compare_counted::comparisons);
+EXPECT_EQ(16u, r.size());
+EXPECT_EQ(15001, r.rbegin()->value);
+
+compare_counted::comparisons = 0;
+large.subtract(small);
+EXPECT_GT(1000u, compare_counted::comparisons);
+EXPECT_EQ((1u << 14) - 16, large.size());
+EXPECT_TRUE(large.find(1001) == large.end());
+}
+
+TEST(fault_injection, set_algebra)
+{
+faulty_run([]
+{
+container a, b;
+mass_insert(a, {3, 1, 5, 7});
+mass_insert(b, {2, 5, 4, 0});
+try
+{
+expect_eq(set_symmetric_difference(a, b), {0, 1, 2, 3, 4, 7});
+a.intersect(b);
+}
+catch (...)
+{
+fault_injection_disable dg;
+expect_eq(a, {1, 3, 5, 7});
+expect_eq(b, {0, 2, 4, 5});
+throw;
+}
+fault_injection_disable dg;
+expect_eq(a, {5});
+});
+}
+
+TEST(features, erase_range)
+{
+counted::no_new_instances_guard g;
+
+// Every range of a few differently shaped trees.
+for (std::vector<int> order : {std::vector<int>{4, 2, 6, 1, 3, 5, 7},
+                               std::vector<int>{1, 2, 3, 4, 5, 6, 7},
+                               std::vector<int>{7, 6, 5, 4, 3, 2, 1},
+                               std::vector<int>{4, 1, 7, 3, 5, 2, 6}})
+    for (int from = 1; from <= 8; ++from)
+        for (int to = from; to <= 8; ++to)
+        {
+            container c;
+            for (int e : order)
+                c.insert(e);
+            container::const_iterator first = c.lower_bound(from), last = c.lower_bound(to);
+            container::const_iterator kept = c.find(from == 1 ? 7 : 1);
+            container::iterator r = c.erase(first, last);
+            EXPECT_EQ(last, r);
+            std::vector<int> expected;
+            for (int e = 1; e <= 7; ++e)
+                if (e < from || e >= to)
+                    expected.push_back(e);
+            std::vector<int> actual;
+            for (counted const& e : c)
+                actual.push_back(e);
+            EXPECT_EQ(expected, actual);
+            actual.clear();
+            for (auto i = c.rbegin(); i != c.rend(); ++i)
+                actual.insert(actual.begin(), *i);
+            EXPECT_EQ(expected, actual);
+            if (to <= 7 || from > 1)
+            {
+                EXPECT_EQ(from == 1 ? 7 : 1, *kept);
+            }
+            c.insert(from);
+            EXPECT_TRUE(c.find(from) != c.end());
+        }
+}
+
+TEST(features, erase_range_copy)
+{
+counted::no_new_instances_guard g;
+
+container c;
+mass_insert(c, {5, 2, 8, 1, 9, 4});
+container c2 = c;
+container::iterator r = c2.erase(c2.find(2), c2.find(8));
+EXPECT_EQ(8, *r);
+expect_eq(c2, {1, 8, 9});
+expect_eq(c, {1, 2, 4, 5, 8, 9});
+container c3 = c;
+c3.erase(c3.find(4), c3.end());
+expect_eq(c3, {1, 2});
+expect_eq(c, {1, 2, 4, 5, 8, 9});
+}
+
+TEST(features, erase_if)
+{
+counted::no_new_instances_guard g;
+
+container c;
+for (int i = 0; i != 100; ++i)
+    c.insert(i * 37 % 100);
+container c2 = c;
+EXPECT_EQ(70u, erase_if(c, [](counted const& e) { return e % 10 > 2; }));
+EXPECT_EQ(30u, c.size());
+int expected = 0;
+for (counted const& e : c)
+{
+    EXPECT_EQ(expected, e);
+    expected += expected % 10 == 2 ? 8 : 1;
+}
+EXPECT_EQ(100u, c2.size());
+EXPECT_EQ(0u, erase_if(c, [](counted const&) { return false; }));
+EXPECT_EQ(30u, erase_if(c, [](counted const&) { return true; }));
+EXPECT_TRUE(c.empty());
+}
+
+TEST(features, find_many)
+{
+counted::no_new_instances_guard g;
+
+container c;
+for (int i = 0; i != 100; ++i)
+    c.insert(i * 37 % 100 * 2);
+std::vector<int> keys;
+for (int i = 0; i != 70; ++i)
+    keys.push_back(i * 7 % 211 - 5);
+std::vector<container::const_iterator> found;
+c.find_many(keys.begin(), keys.end(), std::back_inserter(found));
+ASSERT_EQ(keys.size(), found.size());
+for (size_t i = 0; i != keys.size(); ++i)
+    EXPECT_EQ(c.find(keys[i]), found[i]);
+
+std::uint64_t bitmap[2] = {~std::uint64_t(0), ~std::uint64_t(0)};
+c.contains_many(keys.begin(), keys.end(), bitmap);
+for (size_t i = 0; i != keys.size(); ++i)
+    EXPECT_EQ(c.count(keys[i]) == 1, (bitmap[i / 64] >> i % 64 & 1) == 1);
+EXPECT_EQ(0u, bitmap[1] >> 6);
+
+container empty;
+found.clear();
+empty.find_many(keys.begin(), keys.begin() + 3, std::back_inserter(found));
+EXPECT_EQ(3u, found.size());
+EXPECT_EQ(empty.end(), found[0]);
+}
+
+TEST(features, insert_many)
+{
+counted::no_new_instances_guard g;
+
+container c;
+std::vector<int> batch = {5, 3, 9, 3, 1, 5};
+EXPECT_EQ(4u, c.insert_many(batch.begin(), batch.end()));
+expect_eq(c, {1, 3, 5, 9});
+
+container c2 = c;
+batch = {10, 0, 4, 9, 2, 6, 10, 8, 7, 4, 1};
+EXPECT_EQ(7u, c.insert_many(batch.begin(), batch.end()));
+expect_eq(c, {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10});
+expect_eq(c2, {1, 3, 5, 9});
+EXPECT_EQ(0u, c.insert_many(batch.begin(), batch.end()));
+EXPECT_EQ(0u, c.insert_many(batch.begin(), batch.begin()));
+EXPECT_EQ(11u, c.size());
+EXPECT_EQ(0, *c.begin());
+EXPECT_EQ(10, *c.rbegin());
+c.erase(5);
+c.insert(11);
+expect_eq(c, {0, 1, 2, 3, 4, 6, 7, 8, 9, 10, 11});
+}
+
+TEST(fault_injection, insert_many)
+{
+faulty_run([]
+{
+container c;
+mass_insert(c, {3, 8, 5});
+std::vector<int> batch = {4, 9, 1, 5, 2};
+try
+{
+EXPECT_EQ(4u, c.insert_many(batch.begin(), batch.end()));
+}
+catch (...)
+{
+fault_injection_disable dg;
+expect_eq(c, {3, 5, 8});
+throw;
+}
+fault_injection_disable dg;
+expect_eq(c, {1, 2, 3, 4, 5, 8, 9});
+});
+}
@@ -112,6 +112,78 @@ container c2 = c;
 EXPECT_TRUE(c2.empty());
 }
 
+TEST(correctness, copy_ctor_independent)
+{
+counted::no_new_instances_guard g;
+
+container c;
+mass_insert(c, {3, 1, 4, 2});
+container c2 = c;
+c.insert(5);
+c2.insert(0);
+expect_eq(c, {1, 2, 3, 4, 5});
+expect_eq(c2, {0, 1, 2, 3, 4});
+}
+
+TEST(correctness, copy_ctor_erase)
+{
+counted::no_new_instances_guard g;
+
+container c;
+mass_insert(c, {3, 1, 4, 2});
+container c2 = c;
+container::iterator i = c2.find(3);
+i = c2.erase(i);
+EXPECT_EQ(4, *i);
+expect_eq(c, {1, 2, 3, 4});
+expect_eq(c2, {1, 2, 4});
+}
+
+TEST(correctness, copy_ctor_clear)
+{
+counted::no_new_instances_guard g;
+
+container c;
+mass_insert(c, {3, 1, 4, 2});
+container c2 = c;
+c.clear();
+EXPECT_TRUE(c.empty());
+expect_eq(c2, {1, 2, 3, 4});
+c.insert(7);
+expect_eq(c, {7});
+}
+
+TEST(correctness, move_ctor)
+{
+counted::no_new_instances_guard g;
+
+container c;
+mass_insert(c, {3, 1, 4, 2});
+container c2 = std::move(c);
+expect_eq(c2, {1, 2, 3, 4});
+c.clear();
+c.insert(5);
+expect_eq(c, {5});
+expect_eq(c2, {1, 2, 3, 4});
+}
+
+TEST(correctness, move_assignment)
+{
+counted::no_new_instances_guard g;
+
+container c;
+mass_insert(c, {3, 1, 4, 2});
+container c2;
+mass_insert(c2, {7, 8});
+c2 = std::move(c);
+expect_eq(c2, {1, 2, 3, 4});
+c.clear();
+c.insert(5);
+c2 = std::move(c2);
+c = std::move(c2);
+expect_eq(c, {1, 2, 3, 4});
+}
+
 TEST(correctness, assignment_operator)
 {
 counted::no_new_instances_guard g;
@@ -0,0 +1,49 @@
+#include "test_allocator.h"
+#include "gtest/gtest.h"
+#include "fault_injection.h"
+
+#include <map>
+
+namespace
+{
+    std::map<void*, int>& allocations()
+    {
+        static std::map<void*, int> result;
+        return result;
+    }
+
+    int last_id = 0;
+}
+
+void* test_allocate(std::size_t size, int id)
+{
+    void* ptr = ::operator new(size);
+
+    fault_injection_disable dg;
+    allocations()[ptr] = id;
+    return ptr;
+}
+
+void test_deallocate(void* ptr, int id)
+{
+    {
+        fault_injection_disable dg;
+        auto it = allocations().find(ptr);
+        if (it == allocations().end())
+        {
+            ADD_FAILURE() << "deallocation of unknown block";
+        }
+        else
+        {
+            EXPECT_EQ(it->second, id);
+            allocations().erase(it);
+        }
+    }
+
+    ::operator delete(ptr);
+}
+
+int test_allocator_next_id()
+{
+    return ++last_id;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <type_traits>
+
+// Registry of the blocks handed out by test_allocator. Every block must be
+// returned to an allocator with the same id it was allocated by.
+void* test_allocate(std::size_t size, int id);
+void test_deallocate(void* ptr, int id);
+int test_allocator_next_id();
+
+// Stateful allocator: allocators with different ids do not compare equal.
+// Copy construction of a container gives the copy a fresh id when Propagate
+// is set, so that the copy cannot share memory with the original.
+template <typename T, bool Propagate>
+struct test_allocator
+{
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::integral_constant<bool, Propagate>;
+    using propagate_on_container_move_assignment = std::integral_constant<bool, Propagate>;
+    using propagate_on_container_swap = std::integral_constant<bool, Propagate>;
+
+    template <typename U>
+    struct rebind
+    {
+        using other = test_allocator<U, Propagate>;
+    };
+
+    test_allocator() noexcept
+            : id(0)
+    {}
+
+    explicit test_allocator(int id) noexcept
+            : id(id)
+    {}
+
+    template <typename U>
+    test_allocator(test_allocator<U, Propagate> const& other) noexcept
+            : id(other.id)
+    {}
+
+    T* allocate(std::size_t n)
+    {
+        return static_cast<T*>(test_allocate(n * sizeof(T), id));
+    }
+
+    void deallocate(T* ptr, std::size_t)
+    {
+        test_deallocate(ptr, id);
+    }
+
+    test_allocator select_on_container_copy_construction() const
+    {
+        return Propagate ? test_allocator(test_allocator_next_id()) : *this;
+    }
+
+    friend bool operator==(test_allocator const& a, test_allocator const& b) noexcept
+    {
+        return a.id == b.id;
+    }
+
+    friend bool operator!=(test_allocator const& a, test_allocator const& b) noexcept
+    {
+        return a.id != b.id;
+    }
+
+    int id;
+};
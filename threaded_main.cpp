@@ -0,0 +1,6 @@
+#include "threaded_set.hpp"
+#include "counted.h"
+using container = threaded_set<counted>;
+
+#include "set_testing.inl"
+#include "threaded_set_features.inl"
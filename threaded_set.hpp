@@ -0,0 +1,404 @@
+#ifndef THREADED_SET
+#define THREADED_SET
+
+#include <utility>
+#include <iterator>
+#include <cstdint>
+#include <cassert>
+
+// Variant of set without parent pointers, a node holds only its two links
+// and the value. A missing child is replaced by a "thread": the left link of
+// such a node points to its in-order predecessor and the right link to its
+// successor, the header standing for both ends. The lowest bit of a link
+// tells a thread from a child.
+//
+// Iterators are a single pointer and follow the same rules as in set: only
+// iterators to erased elements are invalidated, and swap keeps all of them
+// valid. Walking up through threads needs no ancestor stack, so iterators do
+// not depend on the height of the tree, which is not balanced. Finding the
+// parent in erase costs O(height) instead of O(1).
+template<typename T>
+struct threaded_set {
+private:
+    struct base_node;
+
+    struct link {
+        std::uintptr_t bits;
+
+        static link child(base_node* v) noexcept {
+            return link{reinterpret_cast<std::uintptr_t>(v)};
+        }
+
+        static link thread(base_node const* v) noexcept {
+            return link{reinterpret_cast<std::uintptr_t>(v) | 1};
+        }
+
+        bool is_thread() const noexcept {
+            return bits & 1;
+        }
+
+        base_node* get() const noexcept {
+            return reinterpret_cast<base_node*>(bits & ~std::uintptr_t(1));
+        }
+    };
+
+    struct base_node {
+        link left, right;
+    };
+
+    struct node: base_node {
+        T data;
+
+        node() = delete;
+        node(T const& value): data(value) {};
+    };
+
+    // Header: its left child is the root, and the threads at both ends of
+    // the tree point to it.
+    base_node root;
+    size_t _size;
+
+    static base_node* leftmost(base_node* v) noexcept {
+        while (!v->left.is_thread())
+            v = v->left.get();
+        return v;
+    }
+
+    static base_node* rightmost(base_node* v) noexcept {
+        while (!v->right.is_thread())
+            v = v->right.get();
+        return v;
+    }
+
+    static T const& value(base_node const* v) noexcept {
+        return static_cast<node const*>(v)->data;
+    }
+
+    base_node* top() const noexcept {
+        return root.left.is_thread() ? nullptr : root.left.get();
+    }
+
+    // The successor of the largest element in the subtree of a left child is
+    // its parent, and the predecessor of the smallest element in the subtree
+    // of a right child is its parent.
+    base_node* parent(base_node* v) const noexcept {
+        base_node *p = rightmost(v)->right.get();
+        if (!p->left.is_thread() && p->left.get() == v)
+            return p;
+        p = leftmost(v)->left.get();
+        assert(!p->right.is_thread() && p->right.get() == v);
+        return p;
+    }
+
+    void replace_child(base_node* p, base_node* from, base_node* to) noexcept {
+        if (!p->left.is_thread() && p->left.get() == from)
+            p->left = link::child(to);
+        else
+            p->right = link::child(to);
+    }
+
+    // Points the threads at both ends of the tree to the header of *this.
+    void attach_header() noexcept {
+        root.right = link::thread(&root);
+        if (base_node *v = top()) {
+            leftmost(v)->left = link::thread(&root);
+            rightmost(v)->right = link::thread(&root);
+        } else {
+            root.left = link::thread(&root);
+        }
+    }
+
+    // Hangs the new node v below p on the given side, where p has no child.
+    // v takes over the thread p had on that side and threads back to p on
+    // the other.
+    static void link_leaf(base_node* p, base_node* v, bool left) noexcept {
+        if (left) {
+            v->left = p->left;
+            v->right = link::thread(p);
+            p->left = link::child(v);
+        } else {
+            v->left = link::thread(p);
+            v->right = p->right;
+            p->right = link::child(v);
+        }
+    }
+
+    // Fills the empty *this with copies of the elements of other, in a tree
+    // of the same shape and without comparing them. Nodes are copied in
+    // pre-order, each hung as a new leaf, so *this is a valid tree after
+    // every step. When a node of other has no left child, the next one is
+    // the right child of the first node its right threads lead to that has
+    // one; following the same threads in *this leads to the copy of it.
+    void copy_from(threaded_set const& other) {
+        base_node const *s = other.top();
+        base_node *d = &root;
+        bool left = true;
+        while (s) {
+            node *v = new node(value(s));
+            link_leaf(d, v, left);
+            _size++;
+            d = v;
+
+            left = !s->left.is_thread();
+            if (left) {
+                s = s->left.get();
+                continue;
+            }
+            while (s->right.is_thread() && s->right.get() != &other.root) {
+                s = s->right.get();
+                d = d->right.get();
+            }
+            s = s->right.is_thread() ? nullptr : s->right.get();
+        }
+    }
+public:
+    struct iterator: public std::iterator<std::bidirectional_iterator_tag, T const> {
+        iterator() noexcept: ptr(nullptr) {}
+        iterator(base_node const* ptr) noexcept: ptr(ptr) {}
+
+        T const& operator*() const {
+            return value(ptr);
+        }
+
+        T const* operator->() const {
+            return &value(ptr);
+        }
+
+        iterator operator++() {
+            bool thread = ptr->right.is_thread();
+            ptr = ptr->right.get();
+            if (!thread)
+                ptr = leftmost(const_cast<base_node*>(ptr));
+
+            return *this;
+        }
+
+        iterator operator--() {
+            bool thread = ptr->left.is_thread();
+            ptr = ptr->left.get();
+            if (!thread)
+                ptr = rightmost(const_cast<base_node*>(ptr));
+
+            return *this;
+        }
+
+        iterator const operator++(int) {
+            iterator other = *this;
+            ++*this;
+            return other;
+        }
+
+        iterator const operator--(int) {
+            iterator other = *this;
+            --*this;
+            return other;
+        }
+
+        friend bool operator==(iterator const& a, iterator const& b) noexcept {
+            return a.ptr == b.ptr;
+        }
+
+        friend bool operator!=(iterator const& a, iterator const& b) noexcept {
+            return a.ptr != b.ptr;
+        }
+    private:
+        base_node const *ptr;
+
+        friend struct threaded_set;
+    };
+
+    using const_iterator = iterator;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = reverse_iterator;
+
+    threaded_set() noexcept: root{link::thread(&root), link::thread(&root)}, _size(0) {
+    }
+
+    threaded_set(threaded_set const& other): threaded_set() {
+        try {
+            copy_from(other);
+        } catch (...) {
+            clear();
+            throw;
+        }
+    }
+
+    threaded_set& operator=(threaded_set other) noexcept {
+        swap(*this, other);
+        return *this;
+    }
+
+    ~threaded_set() {
+        clear();
+    }
+
+    const_iterator begin() const noexcept {
+        return leftmost(const_cast<base_node*>(&root));
+    }
+
+    const_iterator cbegin() const noexcept {
+        return begin();
+    }
+
+    const_iterator end() const noexcept {
+        return &root;
+    }
+
+    const_iterator cend() const noexcept {
+        return end();
+    }
+
+    const_reverse_iterator rbegin() const noexcept {
+        return std::make_reverse_iterator(end());
+    }
+    const_reverse_iterator crbegin() const noexcept {
+        return rbegin();
+    }
+    const_reverse_iterator rend() const noexcept {
+        return std::make_reverse_iterator(begin());
+    }
+    const_reverse_iterator crend() const noexcept {
+        return rend();
+    }
+
+    std::pair<iterator, bool> insert(T const& value) {
+        base_node *p = &root;
+        bool left = true;
+
+        for (base_node *v = top(); v;) {
+            p = v;
+            if (value < threaded_set::value(v)) {
+                left = true;
+                v = v->left.is_thread() ? nullptr : v->left.get();
+            } else if (threaded_set::value(v) < value) {
+                left = false;
+                v = v->right.is_thread() ? nullptr : v->right.get();
+            } else {
+                return std::make_pair(iterator(v), false);
+            }
+        }
+
+        node *v = new node(value);
+        link_leaf(p, v, left);
+        _size++;
+        return std::make_pair(iterator(v), true);
+    }
+
+    const_iterator find(T const& value) const {
+        base_node *v = top();
+
+        while (v) {
+            if (value < threaded_set::value(v)) {
+                v = v->left.is_thread() ? nullptr : v->left.get();
+            } else if (threaded_set::value(v) < value) {
+                v = v->right.is_thread() ? nullptr : v->right.get();
+            } else {
+                return v;
+            }
+        }
+
+        return end();
+    }
+
+    const_iterator lower_bound(T const& value) const {
+        base_node const *result = &root;
+        base_node *v = top();
+
+        while (v) {
+            if (threaded_set::value(v) < value) {
+                v = v->right.is_thread() ? nullptr : v->right.get();
+            } else {
+                result = v;
+                v = v->left.is_thread() ? nullptr : v->left.get();
+            }
+        }
+
+        return result;
+    }
+
+    const_iterator upper_bound(T const& value) const {
+        base_node const *result = &root;
+        base_node *v = top();
+
+        while (v) {
+            if (value < threaded_set::value(v)) {
+                result = v;
+                v = v->left.is_thread() ? nullptr : v->left.get();
+            } else {
+                v = v->right.is_thread() ? nullptr : v->right.get();
+            }
+        }
+
+        return result;
+    }
+
+    iterator erase(const_iterator it) {
+        --_size;
+
+        iterator result = it;
+        ++result;
+
+        base_node *v = const_cast<base_node*>(it.ptr);
+        base_node *p = parent(v);
+        bool has_left = !v->left.is_thread(), has_right = !v->right.is_thread();
+
+        if (!has_left && !has_right) {
+            if (!p->left.is_thread() && p->left.get() == v)
+                p->left = v->left;
+            else
+                p->right = v->right;
+        } else if (!has_right) {
+            rightmost(v->left.get())->right = v->right;
+            replace_child(p, v, v->left.get());
+        } else if (!has_left) {
+            leftmost(v->right.get())->left = v->left;
+            replace_child(p, v, v->right.get());
+        } else {
+            base_node *next = const_cast<base_node*>(result.ptr);
+            rightmost(v->left.get())->right = link::thread(next);
+            if (v->right.get() != next) {
+                base_node *np = v->right.get();
+                while (np->left.get() != next)
+                    np = np->left.get();
+                np->left = next->right.is_thread() ? link::thread(next) : next->right;
+                next->right = v->right;
+            }
+            next->left = v->left;
+            replace_child(p, v, next);
+        }
+
+        delete static_cast<node*>(v);
+
+        return result;
+    }
+
+    size_t size() const {
+        return _size;
+    }
+
+    bool empty() const {
+        return _size == 0;
+    }
+
+    // Frees the nodes in order. The successor of a node is found through
+    // its right link only, which never leads to a node already freed, so
+    // no stack is needed however deep the tree is.
+    void clear() {
+        for (base_node *v = leftmost(&root); v != &root;) {
+            base_node *next = v->right.is_thread() ? v->right.get() : leftmost(v->right.get());
+            delete static_cast<node*>(v);
+            v = next;
+        }
+        root.left = link::thread(&root);
+        _size = 0;
+    }
+
+    friend void swap(threaded_set& a, threaded_set& b) {
+        std::swap(a.root.left, b.root.left);
+        std::swap(a._size, b._size);
+        a.attach_header();
+        b.attach_header();
+    }
+};
+
+#endif // THREADED_SET
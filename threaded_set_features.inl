@@ -0,0 +1,126 @@
+// Tests of threaded_set behaviour which is not a part of the common
+// container interface checked by set_testing.inl.
+
+TEST(features, swap_iterates_to_new_end)
+{
+counted::no_new_instances_guard g;
+
+container c1, c2;
+mass_insert(c1, {2, 1, 3});
+container::iterator i = c1.begin();
+container::iterator j = std::prev(c1.end());
+swap(c1, c2);
+EXPECT_EQ(c2.end(), std::next(i, 3));
+EXPECT_EQ(c2.end(), ++j);
+EXPECT_EQ(c1.end(), c1.begin());
+}
+
+TEST(features, erase_all_shapes)
+{
+counted::no_new_instances_guard g;
+
+for (int removed = 1; removed <= 15; ++removed)
+{
+    container c;
+    mass_insert(c, {8, 4, 12, 2, 6, 10, 14, 1, 3, 5, 7, 9, 11, 13, 15});
+    container::iterator i = c.erase(c.find(removed));
+    if (removed == 15)
+        EXPECT_EQ(c.end(), i);
+    else
+        EXPECT_EQ(removed + 1, *i);
+
+    int expected = 1;
+    for (container::iterator j = c.begin(); j != c.end(); ++j, ++expected)
+    {
+        if (expected == removed)
+            ++expected;
+        EXPECT_EQ(expected, *j);
+    }
+    expected = 15;
+    for (container::reverse_iterator j = c.rbegin(); j != c.rend(); ++j, --expected)
+    {
+        if (expected == removed)
+            --expected;
+        EXPECT_EQ(expected, *j);
+    }
+}
+}
+
+TEST(features, copy_all_shapes)
+{
+counted::no_new_instances_guard g;
+
+container c;
+mass_insert(c, {8, 4, 12, 2, 6, 10, 14, 1, 3, 5, 7, 9, 11, 13, 15});
+for (int removed = 1; removed <= 15; ++removed)
+{
+    container c2 = c;
+    c2.erase(c2.find(removed));
+    EXPECT_EQ(14u, c2.size());
+
+    int expected = 1;
+    for (container::iterator j = c2.begin(); j != c2.end(); ++j, ++expected)
+    {
+        if (expected == removed)
+            ++expected;
+        EXPECT_EQ(expected, *j);
+    }
+    expected = 15;
+    for (container::reverse_iterator j = c2.rbegin(); j != c2.rend(); ++j, --expected)
+    {
+        if (expected == removed)
+            --expected;
+        EXPECT_EQ(expected, *j);
+    }
+}
+EXPECT_EQ(15u, c.size());
+}
+
+struct compare_counted
+{
+    int value;
+    static size_t comparisons;
+
+    compare_counted(int value) : value(value) {}
+
+    friend bool operator<(compare_counted const& a, compare_counted const& b)
+    {
+        ++comparisons;
+        return a.value < b.value;
+    }
+};
+
+size_t compare_counted::comparisons = 0;
+
+TEST(features, copy_without_comparisons)
+{
+threaded_set<compare_counted> c;
+for (int i : {4, 2, 6, 1, 3, 5, 7})
+    c.insert(i);
+compare_counted::comparisons = 0;
+threaded_set<compare_counted> c2 = c;
+EXPECT_EQ(0u, compare_counted::comparisons);
+c2.insert(0);
+EXPECT_EQ(3u, compare_counted::comparisons);
+EXPECT_EQ(0, c2.begin()->value);
+EXPECT_EQ(7u, c.size());
+}
+
+TEST(features, deep_copy_and_teardown)
+{
+// Inserting in increasing order builds a chain as deep as the set is
+// large; copying it and tearing it down must not recurse.
+int const n = 1 << 14;
+threaded_set<int> c;
+for (int i = 0; i != n; ++i)
+    c.insert(i);
+{
+    threaded_set<int> c2 = c;
+    EXPECT_EQ(size_t(n), c2.size());
+    EXPECT_EQ(n - 1, *c2.rbegin());
+}
+threaded_set<int> c2 = c;
+c2.clear();
+EXPECT_TRUE(c2.empty());
+EXPECT_EQ(size_t(n), c.size());
+}